@@ -0,0 +1,116 @@
+extern "C" {
+#include "lua5.2/lua.h"
+#include "lua5.2/lualib.h"
+#include "lua5.2/lauxlib.h"
+}
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+#include "table.h"
+#include "lua_register.h"
+#include "allocator.h"
+
+/*
+#############################################
+Compares the pool allocator with the default allocator of luaL_newstate on
+the workloads of the tests: objects of registered classes, strings, tables
+and closures created in a loop and collected by the GC.
+#############################################
+*/
+class Sample
+{
+public:
+    Sample(std::string name, int index) : name_(name), index_(index) {}
+
+    std::string get_name()
+    {
+        return name_;
+    }
+
+    int get_index()
+    {
+        return index_;
+    }
+
+private:
+    std::string name_;
+    int index_;
+};
+
+int load_sample(lua_State* l)
+{
+    METHOD(Sample::get_name)::push(l, "get_name");
+    METHOD(Sample::get_index)::push(l, "get_index");
+    return 0;
+}
+
+int load_bench(lua_State* l)
+{
+    registerClass<Sample, std::string, int>(l, load_sample, "Sample");
+    return 0;
+}
+
+static const char* workload =
+        "Bench = require(\"Bench\") "
+        "function run(n) "
+        "  local total = 0 "
+        "  for i = 1, n do "
+        "    local s = Bench.Sample(\"sample\" .. i, i) "
+        "    local t = { name = s:get_name(), index = s:get_index(), values = { i, i + 1, i + 2 } } "
+        "    local f = function() return t.index end "
+        "    total = total + f() + #t.name "
+        "  end "
+        "  return total "
+        "end";
+
+/**
+ * \param 	l a new state
+ * \param 	iterations number of iterations of the workload
+ * \return 	the duration of the workload in ms
+ */
+double run(lua_State* l, int iterations)
+{
+    luaL_openlibs(l);
+    luaL_getsubtable(l, LUA_REGISTRYINDEX, "_PRELOAD");
+    registerModule<load_bench>(l, "Bench");
+    lua_pop(l, 1);
+    luaL_dostring(l, workload);
+
+    lua_getglobal(l, "run");
+    lua_pushinteger(l, iterations);
+    auto start = std::chrono::steady_clock::now();
+    lua_call(l, 1, 1);
+    lua_gc(l, LUA_GCCOLLECT, 0);
+    auto stop = std::chrono::steady_clock::now();
+    lua_pop(l, 1);
+    return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    const int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+
+    lua_State* l = luaL_newstate();
+    double default_ms = run(l, iterations);
+    lua_close(l);
+
+    PoolAllocator allocator;
+    l = allocator.newstate();
+    double pool_ms = run(l, iterations);
+    const AllocatorStats& stats = allocator.stats();
+
+    printf("iterations: %d\n", iterations);
+    printf("default allocator: %.1f ms\n", default_ms);
+    printf("pool allocator: %.1f ms\n", pool_ms);
+    printf("allocations: %lu (%.0f/s)\n", (unsigned long)stats.allocations, stats.allocations_per_second());
+    printf("frees: %lu, resizes: %lu\n", (unsigned long)stats.frees, (unsigned long)stats.resizes);
+    printf("live bytes: %lu, peak bytes: %lu\n", (unsigned long)stats.live_bytes, (unsigned long)stats.peak_bytes);
+    printf("size histogram:\n");
+    for(int i = 0; i < AllocatorStats::HISTOGRAM_SIZE; ++i)
+        printf("  >= %6lu bytes: %lu\n", 1ul << i, (unsigned long)stats.histogram[i]);
+
+    lua_close(l);
+    return 0;
+}
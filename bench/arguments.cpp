@@ -0,0 +1,131 @@
+extern "C" {
+#include "lua5.2/lua.h"
+#include "lua5.2/lualib.h"
+#include "lua5.2/lauxlib.h"
+}
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <new>
+
+#include "table.h"
+#include "lua_register.h"
+
+/*
+#############################################
+Microbenchmark of the argument unpacking: a method with six arguments, four
+of them are strings, is called from Lua and the copies and the allocations
+made by the binding are counted.
+
+Every string is longer than the small string buffer so reading it from Lua
+allocates exactly once: the expected result is 4 allocations per call and
+1 copy of the Probe (from the userdata to the parameter).
+#############################################
+*/
+static unsigned long allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    void* p = std::malloc(size);
+    if(p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+static unsigned long probe_copies = 0;
+static unsigned long probe_moves = 0;
+
+class Probe
+{
+public:
+    Probe() {}
+
+    Probe(const Probe&)
+    {
+        ++probe_copies;
+    }
+
+    Probe(Probe&&)
+    {
+        ++probe_moves;
+    }
+};
+
+class Device
+{
+public:
+    Device() : total_(0) {}
+
+    void six(std::string a, std::string b, const std::string& c, Probe, std::string d, int e)
+    {
+        total_ += a.size() + b.size() + c.size() + d.size() + e;
+    }
+
+    std::size_t total_;
+};
+
+int load_probe(lua_State*)
+{
+    return 0;
+}
+
+int load_device(lua_State* l)
+{
+    METHOD(Device::six)::push(l, "six");
+    return 0;
+}
+
+int load_bench(lua_State* l)
+{
+    registerClass<Probe>(l, load_probe, "Probe");
+    registerClass<Device>(l, load_device, "Device");
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const int calls = argc > 1 ? atoi(argv[1]) : 100000;
+
+    lua_State* l = luaL_newstate();
+    luaL_openlibs(l);
+    luaL_getsubtable(l, LUA_REGISTRYINDEX, "_PRELOAD");
+    registerModule<load_bench>(l, "Bench");
+    lua_pop(l, 1);
+
+    luaL_dostring(l, "Bench = require(\"Bench\") "
+                  "device = Bench.Device() "
+                  "probe = Bench.Probe() "
+                  "a = string.rep(\"a\", 32) "
+                  "function run(n) "
+                  "  for i = 1, n do device:six(a, a, a, probe, a, i) end "
+                  "end");
+
+    lua_getglobal(l, "run");
+    lua_pushinteger(l, calls);
+    allocations = 0;
+    auto start = std::chrono::steady_clock::now();
+    lua_call(l, 1, 0);
+    auto stop = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+
+    printf("calls: %d\n", calls);
+    printf("ns/call: %.1f\n", ns / calls);
+    printf("allocations/call: %.2f (4 expected)\n", double(allocations) / calls);
+    printf("Probe copies/call: %.2f (1 expected)\n", double(probe_copies) / calls);
+    printf("Probe moves/call: %.2f\n", double(probe_moves) / calls);
+
+    lua_close(l);
+    return 0;
+}
@@ -0,0 +1,370 @@
+extern "C" {
+#include "lua5.2/lua.h"
+#include "lua5.2/lualib.h"
+#include "lua5.2/lauxlib.h"
+}
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <new>
+#include <string>
+
+#include "table.h"
+#include "lua_register.h"
+
+/*
+#############################################
+Call overhead of each kind of binding, compared with a hand-written
+lua_CFunction that does the same work with the C API:
+    - MODULEFUNCTION, STATICMETHOD and METHOD with 0 to 8 arguments
+      (int, double, bool, std::string, int, double, bool, const std::string&)
+    - a method inherited 1 to 5 levels deep
+    - registerAttribute get and set
+    - constructor and __gc
+    - std::function callback
+
+Usage: overhead [calls]
+The output is CSV, one line per case:
+    case,arity,ns_per_call,allocs_per_call,baseline_ns_per_call,baseline_allocs_per_call
+The allocations are the ones of operator new and of the lua_Alloc.
+#############################################
+*/
+static unsigned long allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    void* p = std::malloc(size);
+    if(p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+static void* counting_alloc(void*, void* ptr, std::size_t osize, std::size_t nsize)
+{
+    if(nsize == 0)
+    {
+        std::free(ptr);
+        return NULL;
+    }
+    if(ptr == NULL || nsize > osize)
+        ++allocations;
+    return std::realloc(ptr, nsize);
+}
+
+#define BENCH_FUNCTIONS(prefix, qualifier) \
+    qualifier int prefix##0() { return 0; } \
+    qualifier int prefix##1(int a) { return a; } \
+    qualifier int prefix##2(int a, double b) { return a + int(b); } \
+    qualifier int prefix##3(int a, double b, bool c) { return a + int(b) + c; } \
+    qualifier int prefix##4(int a, double b, bool c, std::string d) \
+    { return a + int(b) + c + int(d.size()); } \
+    qualifier int prefix##5(int a, double b, bool c, std::string d, int e) \
+    { return a + int(b) + c + int(d.size()) + e; } \
+    qualifier int prefix##6(int a, double b, bool c, std::string d, int e, double f) \
+    { return a + int(b) + c + int(d.size()) + e + int(f); } \
+    qualifier int prefix##7(int a, double b, bool c, std::string d, int e, double f, bool g) \
+    { return a + int(b) + c + int(d.size()) + e + int(f) + g; } \
+    qualifier int prefix##8(int a, double b, bool c, std::string d, int e, double f, bool g, const std::string& h) \
+    { return a + int(b) + c + int(d.size()) + e + int(f) + g + int(h.size()); }
+
+BENCH_FUNCTIONS(f, inline)
+
+class Object
+{
+public:
+    Object() : x(0) {}
+
+    BENCH_FUNCTIONS(s, static)
+    BENCH_FUNCTIONS(m, )
+
+    int x;
+};
+
+class Level0
+{
+public:
+    int value()
+    {
+        return 1;
+    }
+};
+
+class Level1 : public Level0 {};
+class Level2 : public Level1 {};
+class Level3 : public Level2 {};
+class Level4 : public Level3 {};
+class Level5 : public Level4 {};
+
+int call_back(std::function<int(int)> f)
+{
+    return f(1);
+}
+
+/**
+ * \brief 	The hand-written version of the bound functions: the arguments
+ *          from first are read with the C API, with the same types.
+ */
+template <int N, int first>
+int raw_call(lua_State* l)
+{
+    if(first == 2)
+        luaL_checkany(l, 1);
+    lua_Integer total = 0;
+    for(int i = 0; i < N; ++i)
+    {
+        switch(i % 4)
+        {
+        case 0: total += luaL_checkinteger(l, first + i); break;
+        case 1: total += lua_Integer(luaL_checknumber(l, first + i)); break;
+        case 2: total += lua_toboolean(l, first + i); break;
+        default:
+            std::size_t size;
+            luaL_checklstring(l, first + i, &size);
+            total += size;
+        }
+    }
+    lua_pushinteger(l, total);
+    return 1;
+}
+
+int raw_value(lua_State* l)
+{
+    luaL_checktype(l, 1, LUA_TUSERDATA);
+    lua_pushinteger(l, 1);
+    return 1;
+}
+
+int raw_point_index(lua_State* l)
+{
+    int* x = static_cast<int*>(luaL_checkudata(l, 1, "RawPoint"));
+    if(strcmp(luaL_checkstring(l, 2), "x") != 0)
+        return 0;
+    lua_pushinteger(l, *x);
+    return 1;
+}
+
+int raw_point_newindex(lua_State* l)
+{
+    int* x = static_cast<int*>(luaL_checkudata(l, 1, "RawPoint"));
+    if(strcmp(luaL_checkstring(l, 2), "x") == 0)
+        *x = luaL_checkinteger(l, 3);
+    return 0;
+}
+
+int raw_gc(lua_State* l)
+{
+    static_cast<Object*>(lua_touserdata(l, 1))->~Object();
+    return 0;
+}
+
+int raw_new(lua_State* l)
+{
+    new(lua_newuserdata(l, sizeof(Object))) Object();
+    luaL_setmetatable(l, "RawObject");
+    return 1;
+}
+
+int raw_point(lua_State* l)
+{
+    *static_cast<int*>(lua_newuserdata(l, sizeof(int))) = 0;
+    luaL_setmetatable(l, "RawPoint");
+    return 1;
+}
+
+int raw_call_back(lua_State* l)
+{
+    luaL_checktype(l, 2, LUA_TFUNCTION);
+    lua_pushvalue(l, 2);
+    lua_pushnil(l);
+    lua_pushinteger(l, 1);
+    lua_call(l, 2, 1);
+    lua_Integer result = lua_tointeger(l, -1);
+    lua_pushinteger(l, result);
+    return 1;
+}
+
+constexpr luaL_Reg object_methods[] = {
+    {"m0", METHOD(Object::m0)::call}, {"m1", METHOD(Object::m1)::call},
+    {"m2", METHOD(Object::m2)::call}, {"m3", METHOD(Object::m3)::call},
+    {"m4", METHOD(Object::m4)::call}, {"m5", METHOD(Object::m5)::call},
+    {"m6", METHOD(Object::m6)::call}, {"m7", METHOD(Object::m7)::call},
+    {"m8", METHOD(Object::m8)::call},
+    {"raw_m0", raw_call<0, 2>}, {"raw_m1", raw_call<1, 2>}, {"raw_m2", raw_call<2, 2>},
+    {"raw_m3", raw_call<3, 2>}, {"raw_m4", raw_call<4, 2>}, {"raw_m5", raw_call<5, 2>},
+    {"raw_m6", raw_call<6, 2>}, {"raw_m7", raw_call<7, 2>}, {"raw_m8", raw_call<8, 2>}
+};
+
+constexpr luaL_Reg object_statics[] = {
+    {"s0", STATICMETHOD(Object::s0)::call}, {"s1", STATICMETHOD(Object::s1)::call},
+    {"s2", STATICMETHOD(Object::s2)::call}, {"s3", STATICMETHOD(Object::s3)::call},
+    {"s4", STATICMETHOD(Object::s4)::call}, {"s5", STATICMETHOD(Object::s5)::call},
+    {"s6", STATICMETHOD(Object::s6)::call}, {"s7", STATICMETHOD(Object::s7)::call},
+    {"s8", STATICMETHOD(Object::s8)::call},
+    {"raw_s0", raw_call<0, 1>}, {"raw_s1", raw_call<1, 1>}, {"raw_s2", raw_call<2, 1>},
+    {"raw_s3", raw_call<3, 1>}, {"raw_s4", raw_call<4, 1>}, {"raw_s5", raw_call<5, 1>},
+    {"raw_s6", raw_call<6, 1>}, {"raw_s7", raw_call<7, 1>}, {"raw_s8", raw_call<8, 1>}
+};
+
+constexpr luaL_Reg module_functions[] = {
+    {"f0", MODULEFUNCTION(f0)::call}, {"f1", MODULEFUNCTION(f1)::call},
+    {"f2", MODULEFUNCTION(f2)::call}, {"f3", MODULEFUNCTION(f3)::call},
+    {"f4", MODULEFUNCTION(f4)::call}, {"f5", MODULEFUNCTION(f5)::call},
+    {"f6", MODULEFUNCTION(f6)::call}, {"f7", MODULEFUNCTION(f7)::call},
+    {"f8", MODULEFUNCTION(f8)::call},
+    {"raw_f0", raw_call<0, 2>}, {"raw_f1", raw_call<1, 2>}, {"raw_f2", raw_call<2, 2>},
+    {"raw_f3", raw_call<3, 2>}, {"raw_f4", raw_call<4, 2>}, {"raw_f5", raw_call<5, 2>},
+    {"raw_f6", raw_call<6, 2>}, {"raw_f7", raw_call<7, 2>}, {"raw_f8", raw_call<8, 2>},
+    {"call_back", MODULEFUNCTION(call_back)::call}, {"raw_call_back", raw_call_back},
+    {"raw_new", raw_new}, {"raw_point", raw_point}
+};
+
+constexpr luaL_Reg level0_methods[] = {
+    {"value", METHOD(Level0::value)::call},
+    {"raw_value", raw_value}
+};
+
+int load_object(lua_State* l)
+{
+    registerMethods(l, object_methods);
+    registerAttribute<int, Object, &Object::x>(l, "x");
+    return 0;
+}
+
+int load_object_statics(lua_State* l)
+{
+    registerFunctions(l, object_statics);
+    return 0;
+}
+
+int load_level(lua_State*)
+{
+    return 0;
+}
+
+int load_bench(lua_State* l)
+{
+    registerClass<Object>(l, load_object, load_object_statics, "Object");
+    registerClass<Level0>(l, level0_methods, "Level0");
+    registerClassInherit<Level1, Level0>(l, load_level, "Level1", "Level0");
+    registerClassInherit<Level2, Level1>(l, load_level, "Level2", "Level1");
+    registerClassInherit<Level3, Level2>(l, load_level, "Level3", "Level2");
+    registerClassInherit<Level4, Level3>(l, load_level, "Level4", "Level3");
+    registerClassInherit<Level5, Level4>(l, load_level, "Level5", "Level4");
+    registerFunctions(l, module_functions);
+
+    //The metatables of the hand-written userdata
+    luaL_newmetatable(l, "RawObject");
+    lua_pushcfunction(l, raw_gc);
+    lua_setfield(l, -2, "__gc");
+    lua_pop(l, 1);
+    luaL_newmetatable(l, "RawPoint");
+    lua_pushcfunction(l, raw_point_index);
+    lua_setfield(l, -2, "__index");
+    lua_pushcfunction(l, raw_point_newindex);
+    lua_setfield(l, -2, "__newindex");
+    lua_pop(l, 1);
+    return 0;
+}
+
+struct Result
+{
+    double ns;
+    double allocations;
+};
+
+/**
+ * \param 	l lua_State*
+ * \param 	setup Lua code run once, it declares the locals used by body
+ * \param 	body Lua code run calls times
+ * \param 	calls number of iterations
+ * \return 	the time and the allocations per iteration
+ */
+Result measure(lua_State* l, const std::string& setup, const std::string& body, int calls)
+{
+    const std::string code = "local Bench = require(\"Bench\") " + setup +
+            " return function(n) for i = 1, n do " + body + " end end";
+    if(luaL_dostring(l, code.c_str()) != LUA_OK)
+    {
+        fprintf(stderr, "%s\n", lua_tostring(l, -1));
+        lua_pop(l, 1);
+        return Result{0, 0};
+    }
+    //Warm up
+    lua_pushvalue(l, -1);
+    lua_pushinteger(l, calls / 10 + 1);
+    lua_call(l, 1, 0);
+    lua_gc(l, LUA_GCCOLLECT, 0);
+
+    lua_pushinteger(l, calls);
+    allocations = 0;
+    auto start = std::chrono::steady_clock::now();
+    lua_call(l, 1, 0);
+    //The objects created by the loop are destroyed in the measure
+    lua_gc(l, LUA_GCCOLLECT, 0);
+    auto stop = std::chrono::steady_clock::now();
+    Result result;
+    result.ns = std::chrono::duration<double, std::nano>(stop - start).count() / calls;
+    result.allocations = double(allocations) / calls;
+    return result;
+}
+
+void report(lua_State* l, const char* name, int arity, const std::string& setup,
+            const std::string& body, const std::string& baseline, int calls)
+{
+    Result bound = measure(l, setup, body, calls);
+    Result raw = measure(l, setup, baseline, calls);
+    printf("%s,%d,%.2f,%.3f,%.2f,%.3f\n", name, arity, bound.ns, bound.allocations, raw.ns, raw.allocations);
+}
+
+int main(int argc, char** argv)
+{
+    const int calls = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    lua_State* l = lua_newstate(counting_alloc, NULL);
+    luaL_openlibs(l);
+    luaL_getsubtable(l, LUA_REGISTRYINDEX, "_PRELOAD");
+    registerModule<load_bench>(l, "Bench");
+    lua_pop(l, 1);
+
+    static const char* values[] = { "i", "2.5", "true", "'abc'", "i", "2.5", "false", "'abc'" };
+    printf("case,arity,ns_per_call,allocs_per_call,baseline_ns_per_call,baseline_allocs_per_call\n");
+    for(int n = 0; n <= 8; ++n)
+    {
+        std::string args;
+        for(int i = 0; i < n; ++i)
+            args += std::string(", ") + values[i];
+        const std::string index = std::to_string(n);
+        //The module functions have the this of js as first argument
+        report(l, "MODULEFUNCTION", n, "local f, raw = Bench.f" + index + ", Bench.raw_f" + index,
+               "f(nil" + args + ")", "raw(nil" + args + ")", calls);
+        report(l, "STATICMETHOD", n, "local f, raw = Bench.Object.s" + index + ", Bench.Object.raw_s" + index,
+               "f(" + args.substr(args.empty() ? 0 : 2) + ")", "raw(" + args.substr(args.empty() ? 0 : 2) + ")", calls);
+        report(l, "METHOD", n, "local o = Bench.Object()",
+               "o:m" + index + "(" + args.substr(args.empty() ? 0 : 2) + ")",
+               "o:raw_m" + index + "(" + args.substr(args.empty() ? 0 : 2) + ")", calls);
+    }
+    for(int depth = 1; depth <= 5; ++depth)
+        report(l, "inherited_METHOD", depth, "local o = Bench.Level" + std::to_string(depth) + "()",
+               "o:value()", "o:raw_value()", calls);
+    report(l, "attribute_get", 0, "local o, p = Bench.Object(), Bench.raw_point()", "local v = o.x", "local v = p.x", calls);
+    report(l, "attribute_set", 1, "local o, p = Bench.Object(), Bench.raw_point()", "o.x = i", "p.x = i", calls);
+    report(l, "constructor_gc", 0, "", "Bench.Object()", "Bench.raw_new()", calls);
+    report(l, "std_function_callback", 1, "local cb = function(this, v) return v end",
+           "Bench.call_back(nil, cb)", "Bench.raw_call_back(nil, cb)", calls);
+
+    lua_close(l);
+    return 0;
+}
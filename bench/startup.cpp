@@ -0,0 +1,112 @@
+extern "C" {
+#include "lua5.2/lua.h"
+#include "lua5.2/lualib.h"
+#include "lua5.2/lauxlib.h"
+}
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bytecode_cache.h"
+
+/*
+#############################################
+Startup time of a state that loads its scripts: compiled from the source
+(no cache), with a cold cache (compiled, then dumped in the cache) and with
+a warm cache (bytecode mapped from the cache files).
+
+The scripts are generated: several modules of many small functions, loaded
+with require through the searcher of the cache.
+#############################################
+*/
+static const int modules = 20;
+
+std::string generate_module(int index, int functions)
+{
+    std::string source = "local M = {}\n";
+    for(int i = 0; i < functions; ++i)
+    {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer),
+                 "function M.f%d(a, b)\n"
+                 "  local t = { a, b, %d, \"module %d\" }\n"
+                 "  if a > b then return t[1] * %d else return #t[4] + b end\n"
+                 "end\n", i, i, index, i);
+        source += buffer;
+    }
+    return source + "return M\n";
+}
+
+/**
+ * \param 	directory the cache directory, its files are removed so the
+ *          first start with the cache is a cold start
+ */
+void clear_cache(const char* directory)
+{
+    DIR* dir = opendir(directory);
+    if(dir == NULL)
+        return;
+    while(dirent* entry = readdir(dir))
+    {
+        if(entry->d_name[0] != '.')
+            unlink((std::string(directory) + "/" + entry->d_name).c_str());
+    }
+    closedir(dir);
+}
+
+/**
+ * \param 	cache NULL to compile the sources
+ * \return 	the time spent to create the state and require the modules in ms
+ */
+double start(BytecodeCache* cache)
+{
+    auto begin = std::chrono::steady_clock::now();
+    lua_State* l = luaL_newstate();
+    luaL_openlibs(l);
+    if(cache != NULL)
+        cache->install(l);
+    luaL_dostring(l, "package.path = './bench_modules/?.lua'");
+    for(int i = 0; i < modules; ++i)
+    {
+        std::string code = "require('module" + std::to_string(i) + "')";
+        if(luaL_dostring(l, code.c_str()) != LUA_OK)
+            fprintf(stderr, "%s\n", lua_tostring(l, -1));
+    }
+    lua_close(l);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+int main(int argc, char** argv)
+{
+    const int functions = argc > 1 ? atoi(argv[1]) : 500;
+
+    mkdir("bench_modules", 0755);
+    mkdir("bench_cache", 0755);
+    for(int i = 0; i < modules; ++i)
+    {
+        std::string path = "bench_modules/module" + std::to_string(i) + ".lua";
+        FILE* f = fopen(path.c_str(), "w");
+        std::string source = generate_module(i, functions);
+        fwrite(source.data(), 1, source.size(), f);
+        fclose(f);
+    }
+    clear_cache("bench_cache");
+
+    BytecodeCache cache("bench_cache");
+    double source_ms = start(NULL);
+    double cold_ms = start(&cache);
+    const std::size_t cold_misses = cache.misses();
+    double warm_ms = start(&cache);
+
+    printf("modules: %d, functions per module: %d\n", modules, functions);
+    printf("source: %.1f ms\n", source_ms);
+    printf("cold cache: %.1f ms (%lu compiled)\n", cold_ms, (unsigned long)cold_misses);
+    printf("warm cache: %.1f ms (%lu loaded from the cache)\n", warm_ms, (unsigned long)cache.hits());
+    return 0;
+}
@@ -0,0 +1,374 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+/**
+ * Copyright (c) 2014 Domora
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/** A lua_Alloc that keeps the small blocks (up to 256 bytes) in free lists,
+ *  one per size class of 16 bytes. The blocks are carved in chunks so that
+ *  the many small objects of Lua (strings, tables, closures) do not
+ *  fragment the heap. The large blocks use the system allocator.
+ *
+ *  Lua gives the size of a block when it frees or resizes it, so the blocks
+ *  do not need a header.
+ *
+ *  Usage:
+ *      PoolAllocator allocator;
+ *      lua_State* l = allocator.newstate();
+ *      ...
+ *      lua_close(l); //Before the allocator is destroyed
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+
+extern "C" {
+#include "lua5.2/lua.h"
+#include "lua5.2/lualib.h"
+#include "lua5.2/lauxlib.h"
+}
+
+/** The counters of an allocator */
+struct AllocatorStats
+{
+    enum { HISTOGRAM_SIZE = 16 };
+
+    AllocatorStats() :
+        live_bytes(0),
+        peak_bytes(0),
+        allocations(0),
+        frees(0),
+        resizes(0),
+        start(std::chrono::steady_clock::now())
+    {
+        for(int i = 0; i < HISTOGRAM_SIZE; ++i)
+            histogram[i] = 0;
+    }
+
+    /**
+     * \return 	the number of allocations per second since the creation
+     * \author 	Stud
+     */
+    double allocations_per_second() const
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() > 0 ? allocations / elapsed.count() : 0;
+    }
+
+    /** Bytes currently allocated by Lua */
+    std::size_t live_bytes;
+    /** Highest value of live_bytes */
+    std::size_t peak_bytes;
+    std::size_t allocations;
+    std::size_t frees;
+    /** Blocks resized without a new allocation (same size class or realloc) */
+    std::size_t resizes;
+    /** histogram[i] counts the allocations of 2^i to 2^(i+1)-1 bytes, the
+     *  last one counts all the bigger allocations */
+    std::size_t histogram[HISTOGRAM_SIZE];
+    std::chrono::steady_clock::time_point start;
+};
+
+class PoolAllocator
+{
+public:
+    enum {
+        /** Size of the size classes */
+        GRANULARITY = 16,
+        /** Biggest block kept in the pools */
+        MAX_SMALL = 256,
+        CLASSES = MAX_SMALL / GRANULARITY,
+        /** Size of the chunks where the blocks are carved */
+        CHUNK_SIZE = 16 * 1024
+    };
+
+    PoolAllocator()
+    {
+        for(int i = 0; i < CLASSES; ++i)
+            free_[i] = NULL;
+    }
+
+    ~PoolAllocator()
+    {
+        for(std::size_t i = 0; i < chunks_.size(); ++i)
+            std::free(chunks_[i]);
+    }
+
+    PoolAllocator(const PoolAllocator&) = delete;
+    PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+    /**
+     * \return 	a new lua_State that uses the allocator, NULL on failure
+     * \author 	Stud
+     */
+    lua_State* newstate()
+    {
+        lua_State* l = lua_newstate(&PoolAllocator::alloc, this);
+        if(l != NULL)
+            lua_atpanic(l, &PoolAllocator::panic);
+        return l;
+    }
+
+    const AllocatorStats& stats() const
+    {
+        return stats_;
+    }
+
+    /**
+     * \brief 	The lua_Alloc, ud is the PoolAllocator.
+     * \author 	Stud
+     */
+    static void* alloc(void* ud, void* ptr, std::size_t osize, std::size_t nsize)
+    {
+        PoolAllocator* self = static_cast<PoolAllocator*>(ud);
+        //When ptr is NULL, osize is the type of the object, not a size
+        if(ptr == NULL)
+            osize = 0;
+
+        if(nsize == 0)
+        {
+            if(ptr != NULL)
+                self->release(ptr, osize);
+            return NULL;
+        }
+        if(ptr != NULL && size_class(osize) == size_class(nsize) && nsize <= MAX_SMALL)
+        {
+            //Same block, only the counters change
+            self->resize(osize, nsize);
+            return ptr;
+        }
+        if(ptr != NULL && osize > MAX_SMALL && nsize > MAX_SMALL)
+        {
+            void* block = std::realloc(ptr, nsize);
+            if(block == NULL)
+            {
+                if(nsize > osize)
+                    return NULL;
+                //Lua expects a block that shrinks to stay valid
+                block = ptr;
+            }
+            self->resize(osize, nsize);
+            return block;
+        }
+
+        void* block = self->acquire(nsize);
+        if(block == NULL)
+        {
+            if(ptr == NULL || nsize > osize)
+                return NULL;
+            //Lua expects a block that shrinks to stay valid. A small block
+            //is bigger than its new size class which is harmless. A large
+            //block will be released in the pool of its new size class, it
+            //is kept with the chunks to be freed with them.
+            if(osize > MAX_SMALL)
+                self->adopt(ptr);
+            self->resize(osize, nsize);
+            return ptr;
+        }
+        if(ptr != NULL)
+        {
+            std::memcpy(block, ptr, osize < nsize ? osize : nsize);
+            self->release(ptr, osize);
+        }
+        return block;
+    }
+
+private:
+    /**
+     * \return 	the size class of a block, CLASSES for the large blocks
+     */
+    static std::size_t size_class(std::size_t size)
+    {
+        return size > MAX_SMALL ? std::size_t(CLASSES) : (size + GRANULARITY - 1) / GRANULARITY - 1;
+    }
+
+    static int panic(lua_State* l)
+    {
+        fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(l, -1));
+        return 0;
+    }
+
+    void update_peak()
+    {
+        if(stats_.live_bytes > stats_.peak_bytes)
+            stats_.peak_bytes = stats_.live_bytes;
+    }
+
+    void resize(std::size_t osize, std::size_t nsize)
+    {
+        ++stats_.resizes;
+        stats_.live_bytes += nsize;
+        stats_.live_bytes -= osize;
+        update_peak();
+    }
+
+    void count(std::size_t size)
+    {
+        ++stats_.allocations;
+        int bucket = 0;
+        while(size > 1 && bucket < AllocatorStats::HISTOGRAM_SIZE - 1)
+        {
+            size >>= 1;
+            ++bucket;
+        }
+        ++stats_.histogram[bucket];
+        update_peak();
+    }
+
+    void* acquire(std::size_t size)
+    {
+        void* block;
+        if(size > MAX_SMALL)
+            block = std::malloc(size);
+        else
+        {
+            const std::size_t c = size_class(size);
+            if(free_[c] == NULL && !refill(c))
+                return NULL;
+            block = free_[c];
+            free_[c] = *static_cast<void**>(block);
+        }
+        if(block != NULL)
+        {
+            stats_.live_bytes += size;
+            count(size);
+        }
+        return block;
+    }
+
+    void release(void* ptr, std::size_t size)
+    {
+        ++stats_.frees;
+        stats_.live_bytes -= size;
+        if(size > MAX_SMALL)
+        {
+            std::free(ptr);
+            return;
+        }
+        const std::size_t c = size_class(size);
+        *static_cast<void**>(ptr) = free_[c];
+        free_[c] = ptr;
+    }
+
+    /**
+     * \param 	block a large block that becomes a small one
+     * \brief 	Frees the block with the chunks. When even this fails the
+     *          block stays in its pool and is lost with the allocator.
+     */
+    void adopt(void* block)
+    {
+        try
+        {
+            chunks_.push_back(block);
+        }
+        catch(...)
+        {
+            //Never throw through the C code of Lua
+        }
+    }
+
+    /**
+     * \param 	c the size class
+     * \return 	false if there is no memory left
+     * \brief 	Carves a new chunk in blocks of the size class.
+     */
+    bool refill(std::size_t c)
+    {
+        const std::size_t block_size = (c + 1) * GRANULARITY;
+        char* chunk = static_cast<char*>(std::malloc(CHUNK_SIZE));
+        if(chunk == NULL)
+            return false;
+        try
+        {
+            chunks_.push_back(chunk);
+        }
+        catch(...)
+        {
+            //Never throw through the C code of Lua
+            std::free(chunk);
+            return false;
+        }
+        for(std::size_t offset = 0; offset + block_size <= CHUNK_SIZE; offset += block_size)
+        {
+            *reinterpret_cast<void**>(chunk + offset) = free_[c];
+            free_[c] = chunk + offset;
+        }
+        return true;
+    }
+
+    void* free_[CLASSES];
+    std::vector<void*> chunks_;
+    AllocatorStats stats_;
+};
+
+/**
+ * \param 	l lua_State*
+ * \return 	the allocator of the state, NULL if it does not use a PoolAllocator
+ * \author 	Stud
+ */
+inline PoolAllocator* getPoolAllocator(lua_State* l)
+{
+    void* ud;
+    if(lua_getallocf(l, &ud) != &PoolAllocator::alloc)
+        return NULL;
+    return static_cast<PoolAllocator*>(ud);
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Lua function that returns the counters of the allocator in a
+ *          table (live, peak, allocations, frees, resizes, per_second,
+ *          histogram),
+ *          nil if the state does not use a PoolAllocator.
+ */
+inline int allocator_stats(lua_State* l)
+{
+    PoolAllocator* allocator = getPoolAllocator(l);
+    if(allocator == NULL)
+        return 0;
+    const AllocatorStats& stats = allocator->stats();
+    lua_createtable(l, 0, 7);
+    lua_pushunsigned(l, stats.live_bytes);
+    lua_setfield(l, -2, "live");
+    lua_pushunsigned(l, stats.peak_bytes);
+    lua_setfield(l, -2, "peak");
+    lua_pushunsigned(l, stats.allocations);
+    lua_setfield(l, -2, "allocations");
+    lua_pushunsigned(l, stats.frees);
+    lua_setfield(l, -2, "frees");
+    lua_pushunsigned(l, stats.resizes);
+    lua_setfield(l, -2, "resizes");
+    lua_pushnumber(l, stats.allocations_per_second());
+    lua_setfield(l, -2, "per_second");
+    lua_createtable(l, AllocatorStats::HISTOGRAM_SIZE, 0);
+    for(int i = 0; i < AllocatorStats::HISTOGRAM_SIZE; ++i)
+    {
+        lua_pushunsigned(l, stats.histogram[i]);
+        lua_rawseti(l, -2, i + 1);
+    }
+    lua_setfield(l, -2, "histogram");
+    return 1;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Loader of the allocator module, register it with
+ *          registerModule<load_allocator>(l, "Allocator").
+ */
+inline int load_allocator(lua_State* l)
+{
+    lua_pushcfunction(l, allocator_stats);
+    lua_setfield(l, -2, "stats");
+    return 0;
+}
+
+#endif
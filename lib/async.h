@@ -0,0 +1,592 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+/**
+ * Copyright (c) 2014 Domora
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/** Asynchronous functions: a bound function that returns a std::future<T>,
+ *  or that takes a Completion<T> as first parameter and calls it when the
+ *  operation is done (from any thread).
+ *
+ *  Called from a coroutine, the function yields and the scheduler of the
+ *  state resumes the coroutine with the result once it is ready, so a
+ *  single script can have many operations in flight. Called from the main
+ *  thread, the function blocks until the result is ready.
+ *
+ *  A failed operation (the future holds an exception) returns nil and the
+ *  error message.
+ *
+ *  In Lua:
+ *      Async = require("Async")
+ *      Async.spawn(function() local reply = Module.request(nil, "ping") end)
+ *      Async.run() --Or call Async.poll() regularly in the main loop
+ *
+ *  A coroutine waiting on an asynchronous function must not be resumed by
+ *  anything else than the scheduler. */
+
+#include <future>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <exception>
+
+#include "lua_register.h"
+
+/**
+ * \author 	Stud
+ * \brief 	The callback given to the completion style functions, it can be
+ *          called once, from any thread.
+ */
+template <typename T>
+class Completion
+{
+public:
+    Completion() :
+        promise_(std::make_shared<std::promise<T> >())
+    {}
+
+    void operator()(T value) const
+    {
+        promise_->set_value(std::move(value));
+    }
+
+    /**
+     * \param 	e the error, the Lua function returns nil and its message
+     */
+    void fail(std::exception_ptr e) const
+    {
+        promise_->set_exception(e);
+    }
+
+    std::future<T> get_future() const
+    {
+        return promise_->get_future();
+    }
+
+private:
+    std::shared_ptr<std::promise<T> > promise_;
+};
+
+template <>
+class Completion<void>
+{
+public:
+    Completion() :
+        promise_(std::make_shared<std::promise<void> >())
+    {}
+
+    void operator()() const
+    {
+        promise_->set_value();
+    }
+
+    void fail(std::exception_ptr e) const
+    {
+        promise_->set_exception(e);
+    }
+
+    std::future<void> get_future() const
+    {
+        return promise_->get_future();
+    }
+
+private:
+    std::shared_ptr<std::promise<void> > promise_;
+};
+
+/**
+ * \param 	l lua_State*
+ * \param 	result a ready future
+ * \return 	the number of values pushed
+ * \author 	Stud
+ * \brief 	Push the value of the future, or nil and the error message.
+ */
+template <typename T>
+int async_push(lua_State* l, std::future<T>& result)
+{
+    bool failed = false;
+    try
+    {
+        push(l, result.get());
+    }
+    catch(const std::exception& e)
+    {
+        failed = true;
+        lua_pushnil(l);
+        lua_pushstring(l, e.what());
+    }
+    catch(...)
+    {
+        failed = true;
+        lua_pushnil(l);
+        lua_pushstring(l, "unknown exception");
+    }
+    return failed ? 2 : return_count<T>::value;
+}
+
+inline int async_push(lua_State* l, std::future<void>& result)
+{
+    try
+    {
+        result.get();
+    }
+    catch(const std::exception& e)
+    {
+        lua_pushnil(l);
+        lua_pushstring(l, e.what());
+        return 2;
+    }
+    catch(...)
+    {
+        lua_pushnil(l);
+        lua_pushstring(l, "unknown exception");
+        return 2;
+    }
+    return 0;
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	co the coroutine
+ * \param 	nargs the number of values on the coroutine's stack given to it
+ * \author 	Stud
+ * \brief 	Resumes the coroutine, its results are dropped and its errors
+ *          are printed.
+ */
+inline void resume_coroutine(lua_State* l, lua_State* co, int nargs)
+{
+    int status = lua_resume(co, l, nargs);
+    if(status == LUA_YIELD)
+        return;
+    if(status != LUA_OK)
+        fprintf(stderr, "error in coroutine: %s\n", lua_tostring(co, -1));
+    lua_settop(co, 0);
+}
+
+class AsyncScheduler
+{
+public:
+    AsyncScheduler() {}
+
+    AsyncScheduler(const AsyncScheduler&) = delete;
+    AsyncScheduler& operator=(const AsyncScheduler&) = delete;
+
+    /**
+     * \param 	co the coroutine that waits, it must yield right after
+     * \param 	result the future of the operation
+     * \author 	Stud
+     * \brief 	Keeps the coroutine until the result is ready.
+     */
+    template <typename T>
+    void wait(lua_State* co, std::future<T>&& result)
+    {
+        lua_pushthread(co);
+        int ref = luaL_ref(co, LUA_REGISTRYINDEX);
+        pending_.push_back(std::unique_ptr<Pending>(new PendingFuture<T>(co, ref, std::move(result))));
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \return 	the number of coroutines that have been resumed
+     * \author 	Stud
+     * \brief 	Resumes the coroutines whose result is ready.
+     */
+    std::size_t poll(lua_State* l)
+    {
+        //Take the ready operations first, resuming may add new ones
+        std::vector<std::unique_ptr<Pending> > ready;
+        for(std::size_t i = 0; i < pending_.size();)
+        {
+            if(pending_[i]->ready())
+            {
+                ready.push_back(std::move(pending_[i]));
+                pending_[i] = std::move(pending_.back());
+                pending_.pop_back();
+            }
+            else
+                ++i;
+        }
+        for(std::size_t i = 0; i < ready.size(); ++i)
+        {
+            Pending& p = *ready[i];
+            int nresults = p.push(p.co);
+            resume_coroutine(l, p.co, nresults);
+            luaL_unref(l, LUA_REGISTRYINDEX, p.ref);
+        }
+        return ready.size();
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \author 	Stud
+     * \brief 	Polls until no coroutine waits anymore.
+     */
+    void run(lua_State* l)
+    {
+        while(!pending_.empty())
+        {
+            if(poll(l) == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::size_t pending() const
+    {
+        return pending_.size();
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \return 	the scheduler of the state, created on the first call
+     * \author 	Stud
+     */
+    static AsyncScheduler& get(lua_State* l)
+    {
+        lua_rawgetp(l, LUA_REGISTRYINDEX, &key());
+        AsyncScheduler* scheduler = static_cast<AsyncScheduler*>(lua_touserdata(l, -1));
+        lua_pop(l, 1);
+        if(scheduler != NULL)
+            return *scheduler;
+
+        scheduler = new(lua_newuserdata(l, sizeof(AsyncScheduler))) AsyncScheduler();
+        lua_createtable(l, 0, 1);
+        lua_pushcfunction(l, [](lua_State* l) {
+            static_cast<AsyncScheduler*>(lua_touserdata(l, 1))->~AsyncScheduler();
+            return 0;
+        });
+        lua_setfield(l, -2, "__gc");
+        lua_setmetatable(l, -2);
+        lua_rawsetp(l, LUA_REGISTRYINDEX, &key());
+        return *scheduler;
+    }
+
+private:
+    struct Pending
+    {
+        Pending(lua_State* co, int ref) :
+            co(co),
+            ref(ref)
+        {}
+
+        virtual ~Pending() {}
+        virtual bool ready() = 0;
+        /** Push the result on the coroutine, return the number of values */
+        virtual int push(lua_State* co) = 0;
+
+        lua_State* co;
+        int ref;
+    };
+
+    template <typename T>
+    struct PendingFuture : Pending
+    {
+        PendingFuture(lua_State* co, int ref, std::future<T>&& result) :
+            Pending(co, ref),
+            result(std::move(result))
+        {}
+
+        bool ready()
+        {
+            return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }
+
+        int push(lua_State* co)
+        {
+            return async_push(co, result);
+        }
+
+        std::future<T> result;
+    };
+
+    static const char& key()
+    {
+        static const char k = 0;
+        return k;
+    }
+
+    std::vector<std::unique_ptr<Pending> > pending_;
+};
+
+/** Returned by async_return when the coroutine must yield */
+enum { ASYNC_YIELD = -1 };
+
+/**
+ * \param 	l lua_State*
+ * \param 	result the future returned by the bound function
+ * \return 	the number of results pushed, or ASYNC_YIELD
+ * \author 	Stud
+ * \brief 	Push the result if it is ready or if the function is not called
+ *          from a coroutine (it blocks). Otherwise the future is given to
+ *          the scheduler and the caller must return lua_yield(l, 0) once
+ *          its C++ objects are destroyed: lua_yield does not return, with
+ *          Lua built as C it longjmps over the frame that calls it.
+ */
+template <typename T>
+int async_return(lua_State* l, std::future<T>&& result)
+{
+    const bool main = lua_pushthread(l) == 1;
+    lua_pop(l, 1);
+    if(main || result.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        return async_push(l, result);
+    AsyncScheduler::get(l).wait(l, std::move(result));
+    return ASYNC_YIELD;
+}
+
+/**
+     * 	\param 		f the function
+     * 	\param		args tuple filled with initialized arguments
+     * 	\param 		_indices trait used to unpack the tuple
+     * 	\return 	the future of the operation
+     * 	\author 	Stud
+     * */
+template <typename Ret, typename... Args, typename... Stored, std::size_t... N>
+inline std::future<Ret> callAsyncWithTuple(std::future<Ret> (*f)(Args...), std::tuple<Stored...>&& args, _indices<N...>)
+{
+    return f(std::get<N>(std::move(args))...);
+}
+
+template <typename Ret, typename... Args, typename... Stored, std::size_t... N>
+inline std::future<Ret> callAsyncWithTuple(void (*f)(Completion<Ret>, Args...), std::tuple<Stored...>&& args, _indices<N...>)
+{
+    Completion<Ret> done;
+    f(done, std::get<N>(std::move(args))...);
+    return done.get_future();
+}
+
+template <typename Ret, typename ClassName, typename... Args, typename... Stored, std::size_t... N>
+inline std::future<Ret> callAsyncWithTuple(ClassName* obj, std::future<Ret> (ClassName::*f)(Args...), std::tuple<Stored...>&& args, _indices<N...>)
+{
+    return (obj->*f)(std::get<N>(std::move(args))...);
+}
+
+template <typename Ret, typename ClassName, typename... Args, typename... Stored, std::size_t... N>
+inline std::future<Ret> callAsyncWithTuple(ClassName* obj, void (ClassName::*f)(Completion<Ret>, Args...), std::tuple<Stored...>&& args, _indices<N...>)
+{
+    Completion<Ret> done;
+    (obj->*f)(done, std::get<N>(std::move(args))...);
+    return done.get_future();
+}
+
+/**
+ * \author 	Stud
+ * \brief 	The parameters read on the Lua stack, without the Completion.
+ */
+template <typename F> struct async_signature;
+
+template <typename Ret, typename... Args>
+struct async_signature<std::future<Ret> (*)(Args...)> {
+    typedef signature<Args...> args;
+    static constexpr std::size_t count = sizeof...(Args);
+};
+
+template <typename Ret, typename... Args>
+struct async_signature<void (*)(Completion<Ret>, Args...)> {
+    typedef signature<Args...> args;
+    static constexpr std::size_t count = sizeof...(Args);
+};
+
+template <typename Ret, typename ClassName, typename... Args>
+struct async_signature<std::future<Ret> (ClassName::*)(Args...)> {
+    typedef signature<Args...> args;
+    static constexpr std::size_t count = sizeof...(Args);
+};
+
+template <typename Ret, typename ClassName, typename... Args>
+struct async_signature<void (ClassName::*)(Completion<Ret>, Args...)> {
+    typedef signature<Args...> args;
+    static constexpr std::size_t count = sizeof...(Args);
+};
+
+/**
+ * \author 	Stud
+ * \brief 	Reads the parameters of an asynchronous function, without the
+ *          Completion.
+ */
+template <typename F> struct async_args;
+
+template <typename Ret, typename... Args>
+struct async_args<std::future<Ret> (*)(Args...)> {
+    static std::tuple<typename arg_storage<Args>::type...> get(lua_State* l, int index) {
+        return getArgs<Args...>(l, index);
+    }
+};
+
+template <typename Ret, typename... Args>
+struct async_args<void (*)(Completion<Ret>, Args...)> : async_args<std::future<Ret> (*)(Args...)> {};
+
+template <typename Ret, typename ClassName, typename... Args>
+struct async_args<std::future<Ret> (ClassName::*)(Args...)> : async_args<std::future<Ret> (*)(Args...)> {};
+
+template <typename Ret, typename ClassName, typename... Args>
+struct async_args<void (ClassName::*)(Completion<Ret>, Args...)> : async_args<std::future<Ret> (*)(Args...)> {};
+
+/**
+ * \param 	s State that carries lua_State
+ * \param 	name name of the function in the Lua environment
+ * \author 	Stud
+ * \brief 	Structure used to expose an asynchronous function into a module
+ *          (there is always a this from js, like MODULEFUNCTION).
+ */
+template<typename F, F f>
+struct registerAsyncFunction
+{
+    static int call(lua_State* l)
+    {
+        const int results = start(l);
+        //The values given to lua_resume by the scheduler are the results
+        return results != ASYNC_YIELD ? results : lua_yield(l, 0);
+    }
+
+    /**
+     * \brief 	Reads the arguments and calls the function, its objects are
+     *          destroyed before call yields.
+     */
+    static int start(lua_State* l)
+    {
+        auto args = async_args<F>::get(l, 2);
+        return async_return(l, callAsyncWithTuple(f, std::move(args),
+                                                  typename _indices_builder<async_signature<F>::count>::type()));
+    }
+
+    typedef typename async_signature<F>::args arguments;
+    static constexpr int first_arg = 2;
+
+    static bool match(lua_State* l)
+    {
+        return arguments::match(l, first_arg);
+    }
+
+    static void push(lua_State* l, const char* name)
+    {
+        lua_pushcfunction(l, call);
+        lua_setfield(l, -2, name);
+    }
+};
+
+template<typename ClassName, typename F, F f>
+struct registerAsyncMethod
+{
+    typedef ClassName class_type;
+
+    static int call(lua_State* l)
+    {
+        const int results = start(l);
+        //The values given to lua_resume by the scheduler are the results
+        return results != ASYNC_YIELD ? results : lua_yield(l, 0);
+    }
+
+    /**
+     * \brief 	Same as registerAsyncFunction::start with the object.
+     */
+    static int start(lua_State* l)
+    {
+        ClassName* obj = &l_checkClassRef<ClassName>(l, 1);
+        auto args = async_args<F>::get(l, 2);
+        return async_return(l, callAsyncWithTuple(obj, f, std::move(args),
+                                                  typename _indices_builder<async_signature<F>::count>::type()));
+    }
+
+    typedef typename async_signature<F>::args arguments;
+    static constexpr int first_arg = 2;
+
+    static bool match(lua_State* l)
+    {
+        return l_checkClass<ClassName>(l, 1) != NULL && arguments::match(l, first_arg);
+    }
+
+    static void push(lua_State* l, const char* name)
+    {
+        lua_pushcfunction(l, call);
+        //Link the function with the name in the method table
+        set_method(l, name);
+    }
+};
+
+/**
+ * \author 	Stud
+ * \brief 	Gives the class of a member function pointer
+ */
+template <typename F> struct method_class;
+
+template <typename ClassName, typename Ret, typename... Args>
+struct method_class<Ret (ClassName::*)(Args...)> {
+    typedef ClassName type;
+};
+
+/**
+ * \author 	Stud
+ * \brief 	Macro used to register an asynchronous function into a module
+ */
+#define ASYNCFUNCTION(m) registerAsyncFunction<decltype(&m), &m>
+
+/**
+ * \author 	Stud
+ * \brief 	Macro used to register an asynchronous member function
+ */
+#define ASYNCMETHOD(m) registerAsyncMethod<method_class<decltype(&m)>::type, decltype(&m), &m>
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Lua function Async.spawn(f, ...): runs f(...) in a new coroutine
+ *          until its first yield.
+ */
+inline int async_spawn(lua_State* l)
+{
+    luaL_checktype(l, 1, LUA_TFUNCTION);
+    const int nargs = lua_gettop(l) - 1;
+    lua_State* co = lua_newthread(l);
+    lua_insert(l, 1);
+    lua_xmove(l, co, nargs + 1);
+    resume_coroutine(l, co, nargs);
+    return 0;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Lua function Async.poll(): resumes the coroutines whose result
+ *          is ready, returns the number of coroutines still waiting.
+ */
+inline int async_poll(lua_State* l)
+{
+    AsyncScheduler& scheduler = AsyncScheduler::get(l);
+    scheduler.poll(l);
+    lua_pushunsigned(l, scheduler.pending());
+    return 1;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Lua function Async.run(): polls until no coroutine waits.
+ */
+inline int async_run(lua_State* l)
+{
+    AsyncScheduler::get(l).run(l);
+    return 0;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Loader of the async module, register it with
+ *          registerModule<load_async>(l, "Async").
+ */
+inline int load_async(lua_State* l)
+{
+    lua_pushcfunction(l, async_spawn);
+    lua_setfield(l, -2, "spawn");
+    lua_pushcfunction(l, async_poll);
+    lua_setfield(l, -2, "poll");
+    lua_pushcfunction(l, async_run);
+    lua_setfield(l, -2, "run");
+    return 0;
+}
+
+#endif
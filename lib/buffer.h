@@ -0,0 +1,497 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+/**
+ * Copyright (c) 2014 Domora
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/** A Buffer is a registered class that holds numbers (double, float or
+ *  int32_t) in contiguous aligned memory. Lua reads and writes it like a
+ *  table (b[i], #b) and the kernels (sum, min, max, mean, scale, axpy,
+ *  count_above) run over the whole memory in C++.
+ *
+ *  The kernels are plain loops over pointers with independent accumulators
+ *  so that the compiler vectorizes them without -ffast-math.
+ *
+ *  A bound function takes a buffer as Buffer<T>& or, when the standard
+ *  library provides it, as std::span<T>, without any copy. */
+
+#include <climits>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <algorithm>
+#include <type_traits>
+
+#include "lua_register.h"
+
+/** Alignment of the memory of the buffers, a cache line */
+enum { BUFFER_ALIGNMENT = 64 };
+
+/** Number of independent accumulators used by the reductions */
+enum { BUFFER_LANES = 8 };
+
+/** The type of the accumulators of a sum of T: the integers are summed
+ *  in 64 bits so that they do not overflow, the others in lua_Number so
+ *  that a float buffer keeps the precision of the result. */
+template <typename T>
+struct buffer_accumulator {
+    typedef typename std::conditional<std::is_integral<T>::value, int64_t, lua_Number>::type type;
+};
+
+/** The type of the factors and thresholds given to the kernels: the
+ *  integers compare with and are multiplied by a lua_Number, each result
+ *  is then cast back, so that scale(0.5) does not become scale(0). */
+template <typename T>
+struct buffer_scalar {
+    typedef typename std::conditional<std::is_integral<T>::value, lua_Number, T>::type type;
+};
+
+/**
+ * \param 	p the values
+ * \param 	n the number of values
+ * \return 	the sum of the values
+ * \author 	Stud
+ */
+template <typename T>
+inline lua_Number buffer_sum(const T* p, const std::size_t n)
+{
+    typedef typename buffer_accumulator<T>::type Acc;
+    Acc acc[BUFFER_LANES] = {};
+    std::size_t i = 0;
+    for(; i + BUFFER_LANES <= n; i += BUFFER_LANES)
+    {
+        for(std::size_t j = 0; j < BUFFER_LANES; ++j)
+            acc[j] += p[i + j];
+    }
+    Acc sum = 0;
+    for(std::size_t j = 0; j < BUFFER_LANES; ++j)
+        sum += acc[j];
+    for(; i < n; ++i)
+        sum += p[i];
+    return static_cast<lua_Number>(sum);
+}
+
+/**
+ * \param 	p the values
+ * \param 	n the number of values, at least 1
+ * \return 	the smallest value
+ * \author 	Stud
+ */
+template <typename T>
+inline T buffer_min(const T* p, const std::size_t n)
+{
+    T acc[BUFFER_LANES];
+    for(std::size_t j = 0; j < BUFFER_LANES; ++j)
+        acc[j] = p[0];
+    std::size_t i = 0;
+    for(; i + BUFFER_LANES <= n; i += BUFFER_LANES)
+    {
+        for(std::size_t j = 0; j < BUFFER_LANES; ++j)
+            acc[j] = p[i + j] < acc[j] ? p[i + j] : acc[j];
+    }
+    T m = acc[0];
+    for(std::size_t j = 1; j < BUFFER_LANES; ++j)
+        m = acc[j] < m ? acc[j] : m;
+    for(; i < n; ++i)
+        m = p[i] < m ? p[i] : m;
+    return m;
+}
+
+/**
+ * \param 	p the values
+ * \param 	n the number of values, at least 1
+ * \return 	the largest value
+ * \author 	Stud
+ */
+template <typename T>
+inline T buffer_max(const T* p, const std::size_t n)
+{
+    T acc[BUFFER_LANES];
+    for(std::size_t j = 0; j < BUFFER_LANES; ++j)
+        acc[j] = p[0];
+    std::size_t i = 0;
+    for(; i + BUFFER_LANES <= n; i += BUFFER_LANES)
+    {
+        for(std::size_t j = 0; j < BUFFER_LANES; ++j)
+            acc[j] = p[i + j] > acc[j] ? p[i + j] : acc[j];
+    }
+    T m = acc[0];
+    for(std::size_t j = 1; j < BUFFER_LANES; ++j)
+        m = acc[j] > m ? acc[j] : m;
+    for(; i < n; ++i)
+        m = p[i] > m ? p[i] : m;
+    return m;
+}
+
+/**
+ * \param 	p the values
+ * \param 	n the number of values
+ * \param 	threshold the value to compare with
+ * \return 	the number of values strictly greater than the threshold
+ * \author 	Stud
+ */
+template <typename T, typename S>
+inline std::size_t buffer_count_above(const T* p, const std::size_t n, const S threshold)
+{
+    std::size_t count = 0;
+    for(std::size_t i = 0; i < n; ++i)
+        count += p[i] > threshold;
+    return count;
+}
+
+/**
+ * \param 	p the values, updated in place
+ * \param 	n the number of values
+ * \param 	factor the value every element is multiplied by
+ * \author 	Stud
+ */
+template <typename T, typename S>
+inline void buffer_scale(T* __restrict p, const std::size_t n, const S factor)
+{
+    for(std::size_t i = 0; i < n; ++i)
+        p[i] = static_cast<T>(p[i] * factor);
+}
+
+/**
+ * \param 	y the values, updated in place (y = a * x + y)
+ * \param 	x the values added to y
+ * \param 	n the number of values
+ * \param 	a the factor of x
+ * \author 	Stud
+ */
+template <typename T, typename S>
+inline void buffer_axpy(T* __restrict y, const T* __restrict x, const std::size_t n, const S a)
+{
+    for(std::size_t i = 0; i < n; ++i)
+        y[i] = static_cast<T>(y[i] + a * x[i]);
+}
+
+template <typename T>
+class Buffer
+{
+    static_assert(std::is_arithmetic<T>::value, "A buffer holds numbers.");
+
+    typedef typename buffer_scalar<T>::type Scalar;
+
+public:
+    /**
+     * \param 	size the number of values, they are initialized to 0
+     * \author 	Stud
+     */
+    explicit Buffer(int size) :
+        memory_(NULL),
+        data_(NULL),
+        size_(size > 0 ? size : 0)
+    {
+        if(!allocate())
+            throw std::bad_alloc();
+    }
+
+    /**
+     * \param 	size the number of values, they are initialized to 0
+     * \author 	Stud
+     * \brief 	Same as above without exception, the buffer is empty with a
+     *          NULL data() when the memory cannot be allocated.
+     */
+    Buffer(int size, const std::nothrow_t&) :
+        memory_(NULL),
+        data_(NULL),
+        size_(size > 0 ? size : 0)
+    {
+        if(!allocate())
+            size_ = 0;
+    }
+
+    ~Buffer()
+    {
+        std::free(memory_);
+    }
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    T* data()
+    {
+        return data_;
+    }
+
+    const T* data() const
+    {
+        return data_;
+    }
+
+    int size()
+    {
+        return size_;
+    }
+
+    T& operator[](std::size_t i)
+    {
+        return data_[i];
+    }
+
+    const T& operator[](std::size_t i) const
+    {
+        return data_[i];
+    }
+
+    lua_Number sum()
+    {
+        return buffer_sum(data_, size_);
+    }
+
+    lua_Number mean()
+    {
+        return size_ == 0 ? 0 : sum() / size_;
+    }
+
+    lua_Number min()
+    {
+        return size_ == 0 ? 0 : buffer_min(data_, size_);
+    }
+
+    lua_Number max()
+    {
+        return size_ == 0 ? 0 : buffer_max(data_, size_);
+    }
+
+    int count_above(lua_Number threshold)
+    {
+        return buffer_count_above(data_, size_, static_cast<Scalar>(threshold));
+    }
+
+    void scale(lua_Number factor)
+    {
+        buffer_scale(data_, size_, static_cast<Scalar>(factor));
+    }
+
+    /**
+     * \param 	l lua_State*, the factor a and the buffer x of the same
+     *          size are the arguments
+     * \author 	Stud
+     * \brief 	this = a * x + this
+     */
+    void axpy(lua_State* l)
+    {
+        const lua_Number a = luaL_checknumber(l, 2);
+        const Buffer& x = l_checkClassRef<Buffer>(l, 3);
+        if(x.size_ != size_)
+            luaL_error(l, "axpy: buffers of %d and %d values", size_, x.size_);
+        buffer_axpy(data_, x.data_, size_, static_cast<Scalar>(a));
+    }
+
+    /**
+     * \param 	l lua_State*, the table is the first argument
+     * \author 	Stud
+     * \brief 	Copies the sequence of a table in the buffer, the buffer
+     *          keeps its size.
+     */
+    void assign(lua_State* l)
+    {
+        luaL_checktype(l, 2, LUA_TTABLE);
+        const std::size_t n = std::min<std::size_t>(size_, lua_rawlen(l, 2));
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            lua_rawgeti(l, 2, i + 1);
+            data_[i] = static_cast<T>(lua_tonumber(l, -1));
+            lua_pop(l, 1);
+        }
+    }
+
+private:
+    /**
+     * \return 	false if there is no memory left
+     * \brief 	Allocates the aligned memory of size_ values set to 0.
+     */
+    bool allocate()
+    {
+        const std::size_t bytes = size_ * sizeof(T);
+        memory_ = std::malloc(bytes + BUFFER_ALIGNMENT);
+        if(memory_ == NULL)
+            return false;
+        std::uintptr_t address = reinterpret_cast<std::uintptr_t>(memory_);
+        address = (address + BUFFER_ALIGNMENT - 1) & ~std::uintptr_t(BUFFER_ALIGNMENT - 1);
+        data_ = reinterpret_cast<T*>(address);
+        std::memset(data_, 0, bytes);
+        return true;
+    }
+
+    void* memory_;
+    T* data_;
+    int size_;
+};
+
+/**
+ * \param 	l lua_State*
+ * \param 	b the buffer, first argument
+ * \return 	the offset of the element whose index is the second argument
+ * \author 	Stud
+ */
+template <typename T>
+inline std::size_t buffer_offset(lua_State* l, Buffer<T>& b)
+{
+    const lua_Integer i = lua_tointeger(l, 2);
+    luaL_argcheck(l, i >= 1 && i <= b.size(), 2, "index out of range");
+    return i - 1;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	__index of the buffers. The numbers are elements, the other keys
+ *          are given to the __index of the class (the upvalue).
+ */
+template <typename T>
+int bufferIndex(lua_State* l)
+{
+    if(lua_type(l, 2) == LUA_TNUMBER)
+    {
+        Buffer<T>& b = l_checkClassRef<Buffer<T> >(l, 1);
+        lua_pushnumber(l, b[buffer_offset(l, b)]);
+        return 1;
+    }
+    lua_pushvalue(l, lua_upvalueindex(1));
+    lua_insert(l, 1);
+    lua_call(l, 2, 1);
+    return 1;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	__newindex of the buffers, same as bufferIndex.
+ */
+template <typename T>
+int bufferNewIndex(lua_State* l)
+{
+    if(lua_type(l, 2) == LUA_TNUMBER)
+    {
+        Buffer<T>& b = l_checkClassRef<Buffer<T> >(l, 1);
+        b[buffer_offset(l, b)] = static_cast<T>(luaL_checknumber(l, 3));
+        return 0;
+    }
+    lua_pushvalue(l, lua_upvalueindex(1));
+    lua_insert(l, 1);
+    lua_call(l, 3, 0);
+    return 0;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	__len of the buffers
+ */
+template <typename T>
+int bufferLen(lua_State* l)
+{
+    lua_pushinteger(l, l_checkClassRef<Buffer<T> >(l, 1).size());
+    return 1;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Constructor of the buffers (__call of the constructor table, the
+ *          size is the second argument). A failed allocation raises a Lua
+ *          error instead of throwing through the C code of Lua.
+ */
+template <typename T>
+int bufferNew(lua_State* l)
+{
+    const lua_Integer size = luaL_checkinteger(l, 2);
+    luaL_argcheck(l, size <= INT_MAX / lua_Integer(sizeof(T)), 2, "size too large");
+    Buffer<T>* b = new(newObject<Buffer<T> >(l)) Buffer<T>(static_cast<int>(size), std::nothrow);
+    //The metatable first, __gc destroys the buffer even when it is empty
+    getClassMetatable<Buffer<T> >(l);
+    lua_setmetatable(l, -2);
+    if(b->data() == NULL)
+        return luaL_error(l, "not enough memory for a buffer of %d values", static_cast<int>(size));
+    return 1;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Registers the kernels and the metamethods of Buffer<T>, the
+ *          metatable of the class is on top of the stack.
+ */
+template <typename T>
+int load_buffer(lua_State* l)
+{
+    METHOD(Buffer<T>::sum)::push(l, "sum");
+    METHOD(Buffer<T>::mean)::push(l, "mean");
+    METHOD(Buffer<T>::min)::push(l, "min");
+    METHOD(Buffer<T>::max)::push(l, "max");
+    METHOD(Buffer<T>::count_above)::push(l, "count_above");
+    METHOD(Buffer<T>::scale)::push(l, "scale");
+    METHOD(Buffer<T>::axpy)::push(l, "axpy");
+    METHOD(Buffer<T>::assign)::push(l, "assign");
+    METHOD(Buffer<T>::size)::push(l, "size");
+
+    //Wrap the __index and __newindex of the class
+    lua_getfield(l, -1, "__index");
+    lua_pushcclosure(l, bufferIndex<T>, 1);
+    lua_setfield(l, -2, "__index");
+    lua_getfield(l, -1, "__newindex");
+    lua_pushcclosure(l, bufferNewIndex<T>, 1);
+    lua_setfield(l, -2, "__newindex");
+    lua_pushcfunction(l, bufferLen<T>);
+    lua_setfield(l, -2, "__len");
+    return 0;
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	name the name of the class in the module.
+ * \author 	Stud
+ * \brief 	function used to register Buffer<T> within a module, Lua
+ *          instantiates it with its size: Module.name(size).
+ */
+template <typename T>
+void registerBuffer(lua_State* l, const char* name)
+{
+    registerClass<Buffer<T>, int>(l, load_buffer<T>, name);
+    //Replace the constructor
+    lua_getfield(l, -1, name);
+    lua_getmetatable(l, -1);
+    lua_pushcfunction(l, bufferNew<T>);
+    lua_setfield(l, -2, "__call");
+    lua_pop(l, 2);
+}
+
+#ifdef CPPLUA_HAS_SPAN
+/**
+ * \author 	Stud
+ * \param 	_id tag that gives the type
+ * \param 	l lua_State*
+ * \param 	index index on the stack
+ * \param 	_id<std::span<T> > dummy struct indicate a span
+ * \brief 	Reads a view on the memory of a Buffer without copying it
+ */
+template <typename T>
+inline std::span<T> _get(_id<std::span<T> >, lua_State *l, const int index) {
+    typedef typename std::remove_const<T>::type Type;
+    Buffer<Type>& b = l_checkClassRef<Buffer<Type> >(l, index);
+    return std::span<T>(b.data(), b.size());
+}
+
+/**
+  * \author 	Stud
+  * \brief 	Spans are read from buffers
+  */
+template <typename T>
+struct lua_arg<std::span<T> > {
+    static constexpr unsigned int mask = lua_type_bit(LUA_TUSERDATA);
+
+    static bool check(lua_State *l, const int index) {
+        return l_checkClass<Buffer<typename std::remove_const<T>::type> >(l, index) != NULL;
+    }
+};
+#endif
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef BYTECODE_CACHE_H
+#define BYTECODE_CACHE_H
+
+/**
+ * Copyright (c) 2014 Domora
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/** A cache of the compiled Lua chunks. The bytecode given by lua_dump is
+ *  stored in a file of the cache directory named after the hash of the
+ *  source and of the chunkname (the chunkname is kept in the debug
+ *  informations of the bytecode). The file starts with a header that holds
+ *  the hash and the size of the source, the version of the binding and the
+ *  version of Lua: a header that does not match means the cache is stale
+ *  and the source is compiled again. The cache files are memory mapped to be loaded.
+ *
+ *  install() adds a searcher to package.searchers right after the one of
+ *  _PRELOAD (where registerModule puts the C++ modules), so require finds
+ *  the Lua modules of package.path through the cache.
+ *
+ *  Usage:
+ *      BytecodeCache cache("/var/cache/lua");
+ *      cache.install(l); //After luaL_openlibs
+ *      cache.dofile(l, "main.lua");
+ *
+ *  The cache must outlive the states where it is installed. It can be
+ *  shared by states running on several threads (the states of a
+ *  StatePool): the counters are atomic and each store writes its own
+ *  temporary file. */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include "lua5.2/lua.h"
+#include "lua5.2/lualib.h"
+#include "lua5.2/lauxlib.h"
+}
+
+/** Changes when the binding changes in a way that invalidates the chunks
+ *  compiled before (for example the upvalues expected by the modules) */
+#ifndef CPPLUA_BINDING_VERSION
+#define CPPLUA_BINDING_VERSION 1
+#endif
+
+class BytecodeCache
+{
+public:
+    /** The header of a cache file, followed by the bytecode */
+    struct Header
+    {
+        char magic[4];
+        uint32_t binding_version;
+        uint32_t lua_version;
+        uint32_t bytecode_size;
+        uint64_t source_hash;
+        uint64_t source_size;
+    };
+
+    /**
+     * \param 	directory existing directory where the cache files are written
+     * \param 	binding_version version stored in the headers
+     * \author 	Stud
+     */
+    BytecodeCache(std::string directory, uint32_t binding_version = CPPLUA_BINDING_VERSION) :
+        directory_(directory),
+        binding_version_(binding_version),
+        hits_(0),
+        misses_(0)
+    {}
+
+    BytecodeCache(const BytecodeCache&) = delete;
+    BytecodeCache& operator=(const BytecodeCache&) = delete;
+
+    /**
+     * \param 	data the source
+     * \param 	size size of the source
+     * \param 	h hash of the data before, to hash several buffers
+     * \return 	the 64 bits FNV-1a hash of the source
+     * \author 	Stud
+     */
+    static uint64_t hash(const char* data, std::size_t size, uint64_t h = 14695981039346656037ull)
+    {
+        for(std::size_t i = 0; i < size; ++i)
+        {
+            h ^= static_cast<unsigned char>(data[i]);
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    /**
+     * \param 	source the Lua source
+     * \param 	size size of the source
+     * \param 	chunkname name of the chunk
+     * \return 	the hash naming the cache file of the chunk
+     * \author 	Stud
+     */
+    static uint64_t key(const char* source, std::size_t size, const char* chunkname)
+    {
+        //The size of the source is checked with the header, so the
+        //source and the chunkname cannot be mixed up
+        return hash(chunkname, strlen(chunkname), hash(source, size));
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \param 	source the Lua source
+     * \param 	size size of the source
+     * \param 	chunkname name of the chunk, used in the error messages
+     * \return 	the status of luaL_loadbuffer, the chunk (or the error
+     *          message) is pushed on the stack
+     * \author 	Stud
+     * \brief 	Loads the bytecode of the cache if it is up to date,
+     *          otherwise compiles the source and updates the cache.
+     */
+    int load(lua_State* l, const char* source, std::size_t size, const char* chunkname)
+    {
+        const uint64_t h = key(source, size, chunkname);
+        const std::string path = cache_path(h);
+        if(load_cached(l, path, h, size, chunkname))
+        {
+            ++hits_;
+            return LUA_OK;
+        }
+        ++misses_;
+        //Only the text is accepted, a binary chunk would be cached as is
+        int status = luaL_loadbufferx(l, source, size, chunkname, "t");
+        if(status == LUA_OK)
+            store(l, path, h, size);
+        return status;
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \param 	filename the Lua source file
+     * \return 	the status of luaL_loadfile, the chunk (or the error message)
+     *          is pushed on the stack
+     * \author 	Stud
+     */
+    int loadfile(lua_State* l, const char* filename)
+    {
+        std::string source;
+        if(!read_file(filename, source))
+        {
+            lua_pushfstring(l, "cannot read %s", filename);
+            return LUA_ERRFILE;
+        }
+        const std::string chunkname = std::string("@") + filename;
+        return load(l, source.data(), source.size(), chunkname.c_str());
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \param 	filename the Lua source file
+     * \return 	false if the file cannot be loaded or fails, the error is
+     *          printed
+     * \author 	Stud
+     */
+    bool dofile(lua_State* l, const char* filename)
+    {
+        if(loadfile(l, filename) == LUA_OK && lua_pcall(l, 0, LUA_MULTRET, 0) == LUA_OK)
+            return true;
+        fprintf(stderr, "error in %s: %s\n", filename, lua_tostring(l, -1));
+        lua_pop(l, 1);
+        return false;
+    }
+
+    /**
+     * \param 	l lua_State* where the standard libraries are opened
+     * \author 	Stud
+     * \brief 	Inserts the searcher of the cache in package.searchers,
+     *          after the searcher of _PRELOAD.
+     */
+    void install(lua_State* l)
+    {
+        lua_getglobal(l, "package");
+        lua_getfield(l, -1, "searchers");
+        const int count = static_cast<int>(lua_rawlen(l, -1));
+        for(int i = count; i >= 2; --i)
+        {
+            lua_rawgeti(l, -1, i);
+            lua_rawseti(l, -2, i + 1);
+        }
+        lua_pushlightuserdata(l, this);
+        lua_pushcclosure(l, &BytecodeCache::searcher, 1);
+        lua_rawseti(l, -2, 2);
+        lua_pop(l, 2);
+    }
+
+    /** Number of chunks loaded from the cache */
+    std::size_t hits() const
+    {
+        return hits_.load();
+    }
+
+    /** Number of chunks compiled from the source */
+    std::size_t misses() const
+    {
+        return misses_.load();
+    }
+
+private:
+    static int writer(lua_State*, const void* p, std::size_t size, void* ud)
+    {
+        static_cast<std::string*>(ud)->append(static_cast<const char*>(p), size);
+        return 0;
+    }
+
+    /**
+     * \brief 	The searcher of package.searchers: finds the module in
+     *          package.path and returns its chunk and its file name.
+     */
+    static int searcher(lua_State* l)
+    {
+        BytecodeCache* cache = static_cast<BytecodeCache*>(lua_touserdata(l, lua_upvalueindex(1)));
+        const char* name = luaL_checkstring(l, 1);
+        lua_getglobal(l, "package");
+        lua_getfield(l, -1, "searchpath");
+        lua_pushstring(l, name);
+        lua_getfield(l, -3, "path");
+        lua_call(l, 2, 2);
+        if(lua_isnil(l, -2))
+            return 1; //The message of searchpath
+        const char* filename = lua_tostring(l, -2);
+        if(cache->loadfile(l, filename) != LUA_OK)
+            return luaL_error(l, "error loading module '%s' from file '%s':\n\t%s",
+                              name, filename, lua_tostring(l, -1));
+        lua_pushstring(l, filename);
+        return 2;
+    }
+
+    std::string cache_path(uint64_t h) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.luac", static_cast<unsigned long long>(h));
+        return directory_ + name;
+    }
+
+    static bool read_file(const char* filename, std::string& content)
+    {
+        FILE* f = fopen(filename, "rb");
+        if(f == NULL)
+            return false;
+        char buffer[4096];
+        std::size_t n;
+        while((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+            content.append(buffer, n);
+        const bool ok = ferror(f) == 0;
+        fclose(f);
+        return ok;
+    }
+
+    /**
+     * \return 	true if the cache file is up to date and its chunk is pushed
+     * \brief 	The file is memory mapped, Lua copies the bytecode in its
+     *          own structures so the mapping only lives during the load.
+     */
+    bool load_cached(lua_State* l, const std::string& path, uint64_t h, std::size_t size, const char* chunkname)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(Header))
+        {
+            close(fd);
+            return false;
+        }
+        const std::size_t length = st.st_size;
+        void* map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(map == MAP_FAILED)
+            return false;
+
+        const char* data = static_cast<const char*>(map);
+        Header header;
+        std::memcpy(&header, data, sizeof(Header));
+        bool loaded = false;
+        if(std::memcmp(header.magic, "LUAC", 4) == 0
+                && header.binding_version == binding_version_
+                && header.lua_version == LUA_VERSION_NUM
+                && header.source_hash == h
+                && header.source_size == size
+                && header.bytecode_size == length - sizeof(Header))
+        {
+            loaded = luaL_loadbufferx(l, data + sizeof(Header), header.bytecode_size, chunkname, "b") == LUA_OK;
+            //A cache file that does not load is compiled again
+            if(!loaded)
+                lua_pop(l, 1);
+        }
+        munmap(map, length);
+        return loaded;
+    }
+
+    /**
+     * \brief 	Writes the chunk on top of the stack in the cache. The file
+     *          is written under a temporary name unique to the process and
+     *          to the call then renamed, so a state never maps a partial
+     *          file and two writers never share a temporary file.
+     */
+    void store(lua_State* l, const std::string& path, uint64_t h, std::size_t size)
+    {
+        std::string bytecode;
+        if(lua_dump(l, &BytecodeCache::writer, &bytecode) != 0)
+            return;
+        Header header;
+        std::memcpy(header.magic, "LUAC", 4);
+        header.binding_version = binding_version_;
+        header.lua_version = LUA_VERSION_NUM;
+        header.bytecode_size = static_cast<uint32_t>(bytecode.size());
+        header.source_hash = h;
+        header.source_size = size;
+
+        static std::atomic<unsigned int> count(0);
+        char suffix[48];
+        snprintf(suffix, sizeof(suffix), ".%ld.%u.tmp", static_cast<long>(getpid()), count++);
+        const std::string tmp = path + suffix;
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if(f == NULL)
+            return;
+        const bool ok = fwrite(&header, sizeof(Header), 1, f) == 1
+                && fwrite(bytecode.data(), 1, bytecode.size(), f) == bytecode.size();
+        if(fclose(f) == 0 && ok)
+            rename(tmp.c_str(), path.c_str());
+        else
+            remove(tmp.c_str());
+    }
+
+    const std::string directory_;
+    const uint32_t binding_version_;
+    std::atomic<std::size_t> hits_;
+    std::atomic<std::size_t> misses_;
+};
+
+#endif
@@ -0,0 +1,277 @@
+#ifndef CALL_STATS_H
+#define CALL_STATS_H
+
+/**
+ * Copyright (c) 2014 Domora
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/** Counters of the bound functions, compiled only when CPPLUA_ENABLE_STATS
+ *  is defined. Without it, CPPLUA_PROBE expands to nothing and the wrappers
+ *  are pushed as plain C functions.
+ *
+ *  With it, each function pushed by METHOD, STATICMETHOD, MODULEFUNCTION,
+ *  METHODS and STATICMETHODS (and each attribute of registerAttribute) gets
+ *  the CallStats of its name as upvalue: the number of calls, the
+ *  cumulated time and a histogram of the durations (bucket i counts the
+ *  calls of 2^i to 2^(i+1)-1 ns). The counters belong to the state, they
+ *  are relaxed atomics so that they can be read from another thread while
+ *  the state runs.
+ *
+ *  The names are "Class.method" for the methods and the attributes (with
+ *  ":get" or ":set"), the bare name for the other functions. An overload
+ *  set is counted once under its name, whatever overload it calls. A call
+ *  that raises a Lua error is not counted, neither are the functions
+ *  installed from registration tables (registerMethods, registerFunctions).
+ *
+ *  In Lua: require("Stats").get()["Class.method"].calls */
+
+#ifdef CPPLUA_ENABLE_STATS
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <new>
+
+extern "C" {
+#include "lua5.2/lua.h"
+#include "lua5.2/lualib.h"
+#include "lua5.2/lauxlib.h"
+}
+
+struct CallStats
+{
+    enum { HISTOGRAM_SIZE = 32 };
+
+    CallStats() :
+        calls(0),
+        total_ns(0)
+    {
+        for(int i = 0; i < HISTOGRAM_SIZE; ++i)
+            histogram[i].store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * \param 	ns the duration of a call
+     * \author 	Stud
+     */
+    void record(uint64_t ns)
+    {
+        int bucket = 0;
+        for(uint64_t v = ns; v > 1 && bucket < HISTOGRAM_SIZE - 1; v >>= 1)
+            ++bucket;
+        calls.fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(ns, std::memory_order_relaxed);
+        histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        calls.store(0, std::memory_order_relaxed);
+        total_ns.store(0, std::memory_order_relaxed);
+        for(int i = 0; i < HISTOGRAM_SIZE; ++i)
+            histogram[i].store(0, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> histogram[HISTOGRAM_SIZE];
+};
+
+/**
+ * \author 	Stud
+ * \brief 	Measures the scope where it lives, does nothing without stats.
+ */
+class CallProbe
+{
+public:
+    explicit CallProbe(CallStats* stats) :
+        stats_(stats)
+    {
+        if(stats_ != NULL)
+            start_ = std::chrono::steady_clock::now();
+    }
+
+    ~CallProbe()
+    {
+        if(stats_ != NULL)
+            stats_->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - start_).count());
+    }
+
+    CallProbe(const CallProbe&) = delete;
+    CallProbe& operator=(const CallProbe&) = delete;
+
+private:
+    CallStats* stats_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/** The value of an attribute in the attribute table when the stats are on */
+struct FieldDescriptor;
+struct AttributeSlot
+{
+    const FieldDescriptor* field;
+    CallStats* get;
+    CallStats* set;
+};
+
+inline const void* getCallStatsKey()
+{
+    static const char key = 0;
+    return &key;
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	name the name of the bound function
+ * \return 	the counters of the name in the state, created on the first call
+ * \author 	Stud
+ * \brief 	The counters are userdata of a table of the registry, indexed
+ *          by the names.
+ */
+inline CallStats* getCallStats(lua_State* l, const char* name)
+{
+    lua_rawgetp(l, LUA_REGISTRYINDEX, getCallStatsKey());
+    if(lua_isnil(l, -1))
+    {
+        lua_pop(l, 1);
+        lua_newtable(l);
+        lua_pushvalue(l, -1);
+        lua_rawsetp(l, LUA_REGISTRYINDEX, getCallStatsKey());
+    }
+    lua_getfield(l, -1, name);
+    CallStats* stats = static_cast<CallStats*>(lua_touserdata(l, -1));
+    if(stats == NULL)
+    {
+        stats = new(lua_newuserdata(l, sizeof(CallStats))) CallStats();
+        lua_setfield(l, -3, name);
+    }
+    lua_pop(l, 2);
+    return stats;
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	name the name of the bound function
+ * \return 	its counters, NULL if it has never been registered
+ * \author 	Stud
+ */
+inline const CallStats* findCallStats(lua_State* l, const char* name)
+{
+    lua_rawgetp(l, LUA_REGISTRYINDEX, getCallStatsKey());
+    if(lua_isnil(l, -1))
+    {
+        lua_pop(l, 1);
+        return NULL;
+    }
+    lua_getfield(l, -1, name);
+    const CallStats* stats = static_cast<const CallStats*>(lua_touserdata(l, -1));
+    lua_pop(l, 2);
+    return stats;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Lua function Stats.get(): a table indexed by the names of the
+ *          functions called at least once, with calls, total_ns, mean_ns
+ *          and histogram.
+ */
+inline int call_stats_get(lua_State* l)
+{
+    lua_newtable(l);
+    lua_rawgetp(l, LUA_REGISTRYINDEX, getCallStatsKey());
+    if(lua_isnil(l, -1))
+    {
+        lua_pop(l, 1);
+        return 1;
+    }
+    lua_pushnil(l);
+    while(lua_next(l, -2) != 0)
+    {
+        const CallStats* stats = static_cast<const CallStats*>(lua_touserdata(l, -1));
+        const uint64_t calls = stats->calls.load(std::memory_order_relaxed);
+        lua_pop(l, 1);
+        if(calls == 0)
+            continue;
+        const uint64_t total = stats->total_ns.load(std::memory_order_relaxed);
+        lua_pushvalue(l, -1);
+        lua_createtable(l, 0, 4);
+        lua_pushnumber(l, lua_Number(calls));
+        lua_setfield(l, -2, "calls");
+        lua_pushnumber(l, lua_Number(total));
+        lua_setfield(l, -2, "total_ns");
+        lua_pushnumber(l, lua_Number(total) / calls);
+        lua_setfield(l, -2, "mean_ns");
+        lua_createtable(l, CallStats::HISTOGRAM_SIZE, 0);
+        for(int i = 0; i < CallStats::HISTOGRAM_SIZE; ++i)
+        {
+            lua_pushnumber(l, lua_Number(stats->histogram[i].load(std::memory_order_relaxed)));
+            lua_rawseti(l, -2, i + 1);
+        }
+        lua_setfield(l, -2, "histogram");
+        lua_rawset(l, -5);
+    }
+    lua_pop(l, 1);
+    return 1;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Lua function Stats.reset(): sets all the counters to 0.
+ */
+inline int call_stats_reset(lua_State* l)
+{
+    lua_rawgetp(l, LUA_REGISTRYINDEX, getCallStatsKey());
+    if(lua_isnil(l, -1))
+        return 0;
+    lua_pushnil(l);
+    while(lua_next(l, -2) != 0)
+    {
+        static_cast<CallStats*>(lua_touserdata(l, -1))->reset();
+        lua_pop(l, 1);
+    }
+    return 0;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Loader of the stats module, register it with
+ *          registerModule<load_call_stats>(l, "Stats").
+ */
+inline int load_call_stats(lua_State* l)
+{
+    lua_pushcfunction(l, call_stats_get);
+    lua_setfield(l, -2, "get");
+    lua_pushcfunction(l, call_stats_reset);
+    lua_setfield(l, -2, "reset");
+    return 0;
+}
+
+/** Measures the call of the wrapper, the counters are its first upvalue */
+#define CPPLUA_PROBE(l) \
+    CallProbe _cpplua_probe(static_cast<CallStats*>(lua_touserdata(l, lua_upvalueindex(1))))
+
+/** Measures the call of an overload set, the counters are its second
+ *  upvalue (the first one is nil, the probe of the overload does nothing) */
+#define CPPLUA_OVERLOAD_PROBE(l) \
+    CallProbe _cpplua_probe(static_cast<CallStats*>(lua_touserdata(l, lua_upvalueindex(2))))
+
+/** Measures the access to the attribute whose slot is at index */
+#define CPPLUA_ATTRIBUTE_PROBE(l, index, accessor) \
+    CallProbe _cpplua_probe(static_cast<const AttributeSlot*>(lua_touserdata(l, index))->accessor)
+
+#else
+
+#define CPPLUA_PROBE(l)
+#define CPPLUA_OVERLOAD_PROBE(l)
+#define CPPLUA_ATTRIBUTE_PROBE(l, index, accessor)
+
+#endif
+
+#endif
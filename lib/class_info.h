@@ -0,0 +1,198 @@
+#ifndef CLASS_INFO_H
+#define CLASS_INFO_H
+
+/**
+ * Copyright (c) 2014 Domora
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/** Each registered class has a ClassInfo that gives it a compact id and
+ *  the offsets used to convert a pointer on the class into a pointer on
+ *  each of its ancestors.
+ *
+ *  Every userdata instantiated by the binding starts with an ObjectHeader
+ *  that points to the ClassInfo of the object, so checking the type of an
+ *  argument and adjusting the pointer is a lookup in a vector, even with
+ *  multiple inheritance. */
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "instance_stats.h"
+
+struct lua_State;
+
+class ClassInfo
+{
+public:
+    ClassInfo() :
+        id_(next_id())
+    {}
+
+    unsigned int get_id() const
+    {
+        return id_;
+    }
+
+    /**
+     * \param 	target the class we want to convert the object to.
+     * \param 	offset filled with the offset to add to the pointer.
+     * \return 	true if the class is the target or inherits from it.
+     * \author 	Stud
+     */
+    bool cast_offset(const ClassInfo& target, std::ptrdiff_t& offset) const
+    {
+        if(target.id_ == id_)
+        {
+            offset = 0;
+            return true;
+        }
+        if(target.id_ >= ancestors_.size() || ancestors_[target.id_] == not_ancestor())
+            return false;
+        offset = ancestors_[target.id_];
+        return true;
+    }
+
+    /**
+     * \param 	parent the ClassInfo of the parent.
+     * \param 	offset the offset between a pointer on the class and a
+     *          pointer on the parent.
+     * \author 	Stud
+     * \brief 	Adds the parent and all of its ancestors to the ancestors
+     *          of the class. The parent must be complete, which is the case
+     *          as a parent is always registered before its children.
+     *          Registering the class again in another state only reads the
+     *          ancestors, it does not write them.
+     */
+    void add_parent(const ClassInfo& parent, std::ptrdiff_t offset)
+    {
+        set_ancestor(parent.id_, offset);
+        for(unsigned int i = 0; i < parent.ancestors_.size(); ++i)
+        {
+            if(parent.ancestors_[i] != not_ancestor())
+                set_ancestor(i, offset + parent.ancestors_[i]);
+        }
+    }
+
+#ifdef CPPLUA_ENABLE_INSTANCE_STATS
+    /** The counters of the instances of the class, see instance_stats.h */
+    InstanceStats& instances() const
+    {
+        return instances_;
+    }
+#endif
+
+private:
+    /** Value of the classes that are not ancestors in ancestors_ */
+    static std::ptrdiff_t not_ancestor()
+    {
+        return PTRDIFF_MIN;
+    }
+
+    static unsigned int next_id()
+    {
+        static std::atomic<unsigned int> count(0);
+        return count++;
+    }
+
+    void set_ancestor(unsigned int id, std::ptrdiff_t offset)
+    {
+        if(id < ancestors_.size() && ancestors_[id] == offset)
+            return;
+        if(id >= ancestors_.size())
+            ancestors_.resize(id + 1, not_ancestor());
+        ancestors_[id] = offset;
+    }
+
+    unsigned int id_;
+    std::vector<std::ptrdiff_t> ancestors_;
+#ifdef CPPLUA_ENABLE_INSTANCE_STATS
+    mutable InstanceStats instances_;
+#endif
+};
+
+/** The header at the beginning of the userdata. The object, or what owns
+ *  it (a smart pointer), follows it. */
+struct ObjectHeader
+{
+    enum { MAGIC = 0x4c554143 };
+
+    /** How the userdata holds the object */
+    enum Mode {
+        /** The object is in the userdata, moved or built there */
+        VALUE,
+        /** The object is owned by C++, the userdata only points to it */
+        BORROWED,
+        /** A std::shared_ptr<void> that owns the object is in the userdata */
+        SHARED,
+        /** A std::unique_ptr that owns the object is in the userdata */
+        UNIQUE
+    };
+
+    unsigned int magic;
+    Mode mode;
+    const ClassInfo* info;
+    void* object;
+    /** Called by __gc, NULL when there is nothing to destroy */
+    void (*destroy)(ObjectHeader*);
+};
+
+/** The descriptor of a public attribute, stored in the attribute table of
+ *  the classes as a light userdata. The accessors read and write the
+ *  member without any call through Lua. */
+struct FieldDescriptor
+{
+    /** The class that declares the member */
+    const ClassInfo* owner;
+    /** The offset of the member in the class that declares it */
+    std::ptrdiff_t offset;
+    /** Push the value of the member on the Lua stack */
+    void (*get)(lua_State*, void* field);
+    /** Set the member with the value at index on the Lua stack */
+    void (*set)(lua_State*, void* field, int index);
+};
+
+/**
+ * \return 	the ClassInfo of the class T
+ * \author 	Stud
+ */
+template <typename T>
+ClassInfo& getClassInfo()
+{
+    static ClassInfo info;
+    return info;
+}
+
+/**
+ * \return 	the offset between a pointer on ClassName and a pointer on Parent
+ * \author 	Stud
+ * \brief 	The offset is the same for every instance as long as Parent is
+ *          not a virtual base, a fake address is enough to compute it.
+ */
+template <typename ClassName, typename Parent>
+std::ptrdiff_t getParentOffset()
+{
+    static_assert(std::is_base_of<Parent, ClassName>::value,
+                  "The parent must be a base of the class.");
+    ClassName* derived = reinterpret_cast<ClassName*>(static_cast<std::uintptr_t>(0x1000));
+    return reinterpret_cast<char*>(static_cast<Parent*>(derived)) - reinterpret_cast<char*>(derived);
+}
+
+/**
+ * \return 	the offset of the member t in ClassName
+ * \author 	Stud
+ * \brief 	Same as getParentOffset, the offset is computed from a fake address.
+ */
+template <typename Type, typename ClassName, Type ClassName::* t>
+std::ptrdiff_t getMemberOffset()
+{
+    ClassName* object = reinterpret_cast<ClassName*>(static_cast<std::uintptr_t>(0x1000));
+    return reinterpret_cast<char*>(&(object->*t)) - reinterpret_cast<char*>(object);
+}
+
+#endif
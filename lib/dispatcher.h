@@ -0,0 +1,407 @@
+#ifndef DISPATCHER_H
+#define DISPATCHER_H
+
+/**
+ * Copyright (c) 2014 Domora
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/** A Lua state must only be used by the thread that runs it. The
+ *  Dispatcher of a state is a lock-free queue (multiple producers, one
+ *  consumer) of jobs: the other threads post jobs, the thread of the state
+ *  runs them in batches when it calls drain.
+ *
+ *  A bound function that takes a PostedFunction<void(Args...)> instead of
+ *  a std::function gets a callback that can be called from any thread:
+ *  called from the thread of the state it runs directly, called from
+ *  another thread it is posted with a copy of the arguments. The function
+ *  is always called on the main thread of the state, never on the
+ *  coroutine where it was given (it may be suspended or dead by then). The
+ *  reference on the Lua function is also released on the thread of the
+ *  state.
+ *
+ *  The PostedFunctions must be destroyed before the state is closed. */
+
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <utility>
+
+#include "lua_register.h"
+
+/** A job of the queue, the queue is intrusive */
+class DispatcherJob
+{
+public:
+    DispatcherJob(bool cleanup = false) :
+        next(NULL),
+        cleanup(cleanup)
+    {}
+
+    virtual ~DispatcherJob() {}
+
+    virtual void run(lua_State*) {}
+
+    std::atomic<DispatcherJob*> next;
+    /** The cleanup jobs (releasing a reference) also run when the state
+     *  is closed, the others are dropped */
+    const bool cleanup;
+};
+
+template <typename F>
+class DispatcherFunctionJob : public DispatcherJob
+{
+public:
+    DispatcherFunctionJob(F&& f, bool cleanup) :
+        DispatcherJob(cleanup),
+        f_(std::move(f))
+    {}
+
+    void run(lua_State* l)
+    {
+        f_(l);
+    }
+
+private:
+    F f_;
+};
+
+class Dispatcher
+{
+public:
+    Dispatcher() :
+        head_(&stub_),
+        tail_(&stub_),
+        owner_(std::this_thread::get_id())
+    {}
+
+    ~Dispatcher()
+    {
+        //Only the cleanup jobs are run, they may post other jobs
+        for(DispatcherJob* job = pop(); job != NULL; job = pop())
+        {
+            if(job->cleanup)
+                job->run(l_);
+            delete job;
+        }
+    }
+
+    Dispatcher(const Dispatcher&) = delete;
+    Dispatcher& operator=(const Dispatcher&) = delete;
+
+    /**
+     * \return 	true if the calling thread is the thread of the state
+     * \author 	Stud
+     */
+    bool is_owner() const
+    {
+        return std::this_thread::get_id() == owner_;
+    }
+
+    /**
+     * \param 	f the job, called with the lua_State*
+     * \param 	cleanup true if the job must run even if the state is closed
+     * \author 	Stud
+     * \brief 	Adds a job to the queue, from any thread.
+     */
+    template <typename F>
+    void post(F&& f, bool cleanup = false)
+    {
+        typedef typename std::decay<F>::type Type;
+        push(new DispatcherFunctionJob<Type>(Type(std::forward<F>(f)), cleanup));
+    }
+
+    /**
+     * \param 	max the maximum number of jobs to run
+     * \return 	the number of jobs that have been run
+     * \author 	Stud
+     * \brief 	Runs the jobs posted so far, on the thread of the state.
+     */
+    std::size_t drain(std::size_t max = SIZE_MAX)
+    {
+        std::size_t count = 0;
+        while(count < max)
+        {
+            DispatcherJob* job = pop();
+            if(job == NULL)
+                break;
+            job->run(l_);
+            delete job;
+            ++count;
+        }
+        return count;
+    }
+
+    /** The main thread of the state, where the jobs run */
+    lua_State* state() const
+    {
+        return l_;
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \return 	the dispatcher of the state, created on the first call
+     * \author 	Stud
+     * \brief 	Must be called on the thread of the state.
+     */
+    static Dispatcher& get(lua_State* l)
+    {
+        lua_rawgetp(l, LUA_REGISTRYINDEX, &key());
+        Dispatcher* dispatcher = static_cast<Dispatcher*>(lua_touserdata(l, -1));
+        lua_pop(l, 1);
+        if(dispatcher != NULL)
+            return *dispatcher;
+
+        dispatcher = new(lua_newuserdata(l, sizeof(Dispatcher))) Dispatcher();
+        lua_rawgeti(l, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+        dispatcher->l_ = lua_tothread(l, -1);
+        lua_pop(l, 1);
+        lua_createtable(l, 0, 1);
+        lua_pushcfunction(l, [](lua_State* l) {
+            static_cast<Dispatcher*>(lua_touserdata(l, 1))->~Dispatcher();
+            return 0;
+        });
+        lua_setfield(l, -2, "__gc");
+        lua_setmetatable(l, -2);
+        lua_rawsetp(l, LUA_REGISTRYINDEX, &key());
+        return *dispatcher;
+    }
+
+private:
+    static const char& key()
+    {
+        static const char k = 0;
+        return k;
+    }
+
+    void push(DispatcherJob* job)
+    {
+        job->next.store(NULL, std::memory_order_relaxed);
+        DispatcherJob* prev = head_.exchange(job, std::memory_order_acq_rel);
+        prev->next.store(job, std::memory_order_release);
+    }
+
+    /**
+     * \return 	the oldest job, NULL if the queue is empty or if a producer
+     *          has not finished its push yet
+     * \brief 	Only called by the thread of the state.
+     */
+    DispatcherJob* pop()
+    {
+        DispatcherJob* tail = tail_;
+        DispatcherJob* next = tail->next.load(std::memory_order_acquire);
+        if(tail == &stub_)
+        {
+            if(next == NULL)
+                return NULL;
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if(next != NULL)
+        {
+            tail_ = next;
+            return tail;
+        }
+        if(tail != head_.load(std::memory_order_acquire))
+            return NULL;
+        push(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if(next != NULL)
+        {
+            tail_ = next;
+            return tail;
+        }
+        return NULL;
+    }
+
+    DispatcherJob stub_;
+    std::atomic<DispatcherJob*> head_;
+    DispatcherJob* tail_;
+    std::thread::id owner_;
+    lua_State* l_;
+};
+
+template <typename Signature>
+class PostedFunction;
+
+/**
+ * \author 	Stud
+ * \brief 	A Lua function that can be called from any thread, see the
+ *          top of the file.
+ */
+template <typename... Args>
+class PostedFunction<void(Args...)>
+{
+public:
+    PostedFunction() :
+        shared_(NULL)
+    {}
+
+    PostedFunction(lua_State* l, int index) :
+        shared_(new Shared(l, index))
+    {}
+
+    PostedFunction(const PostedFunction& f) :
+        shared_(f.shared_)
+    {
+        if(shared_ != NULL)
+            shared_->count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    PostedFunction(PostedFunction&& f) :
+        shared_(f.shared_)
+    {
+        f.shared_ = NULL;
+    }
+
+    PostedFunction& operator=(PostedFunction f)
+    {
+        std::swap(shared_, f.shared_);
+        return *this;
+    }
+
+    ~PostedFunction()
+    {
+        if(shared_ == NULL || shared_->count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        //The reference on the Lua function is released on the thread of the state
+        Shared* shared = shared_;
+        if(shared->dispatcher.is_owner())
+            delete shared;
+        else
+            shared->dispatcher.post([shared](lua_State*) { delete shared; }, true);
+    }
+
+    explicit operator bool() const
+    {
+        return shared_ != NULL;
+    }
+
+    /**
+     * \author 	Stud
+     * \brief 	Calls the Lua function, or posts the call with a copy of the
+     *          arguments when the calling thread is not the one of the state.
+     */
+    void operator()(Args... args) const
+    {
+        if(shared_->dispatcher.is_owner())
+        {
+            call(shared_->dispatcher.state(), shared_->callback, args...);
+            return;
+        }
+        PostedFunction self(*this);
+        std::tuple<typename std::decay<Args>::type...> values(args...);
+        shared_->dispatcher.post(
+            [self, values](lua_State* l) mutable {
+                self.apply(l, values, typename _indices_builder<sizeof...(Args)>::type());
+            });
+    }
+
+private:
+    struct Shared
+    {
+        Shared(lua_State* l, int index) :
+            count(1),
+            dispatcher(Dispatcher::get(l)),
+            callback(track(l, index, dispatcher.state()))
+        {}
+
+        /**
+         * \brief 	The tracker belongs to the main thread, it outlives the
+         *          coroutine where the function was read.
+         */
+        static LuarefTracker track(lua_State* l, int index, lua_State* main)
+        {
+            lua_pushvalue(l, index);
+            lua_xmove(l, main, 1);
+            LuarefTracker tracker(main, -1);
+            lua_pop(main, 1);
+            return tracker;
+        }
+
+        std::atomic<int> count;
+        Dispatcher& dispatcher;
+        LuarefTracker callback;
+    };
+
+    template <typename Tuple, std::size_t... N>
+    void apply(lua_State* l, Tuple& values, _indices<N...>) const
+    {
+        call(l, shared_->callback, std::get<N>(values)...);
+    }
+
+    /**
+     * \param 	l the main thread of the state
+     * \brief 	Calls the function, the errors are printed.
+     */
+    template <typename... Values>
+    static void call(lua_State* l, const LuarefTracker& callback, Values&... values)
+    {
+        const int top = lua_gettop(l);
+        if(!call_callback(l, callback, 0, values...))
+            fprintf(stderr, "error running posted function: %s\n", lua_tostring(l, -1));
+        lua_settop(l, top);
+    }
+
+    Shared* shared_;
+};
+
+/**
+  * \brief 	A const reference on a PostedFunction is read as a value
+  */
+template <typename... Args>
+struct is_primitive<PostedFunction<void(Args...)> > {
+    static constexpr bool value = true;
+};
+
+/**
+ * \author 	Stud
+ * \param 	_id tag that gives the type
+ * \param 	l lua_State*
+ * \param 	index index on the stack
+ * \param 	_id<PostedFunction<void(Args...)> > dummy struct indicate a posted function
+ * \brief 	Reads a Lua function that can be called from any thread.
+ */
+template <typename... Args>
+inline PostedFunction<void(Args...)> _get(_id<PostedFunction<void(Args...)> >, lua_State *l, const int index)
+{
+    return PostedFunction<void(Args...)>(l, index);
+}
+
+/**
+  * \author 	Stud
+  * \brief 	Lua functions used as posted callbacks
+  */
+template <typename... Args>
+struct lua_arg<PostedFunction<void(Args...)> > : lua_arg<std::function<void(Args...)> > {};
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Lua function that runs the posted jobs: Dispatcher.drain([max]),
+ *          returns the number of jobs that have been run.
+ */
+inline int dispatcher_drain(lua_State* l)
+{
+    const std::size_t max = lua_isnumber(l, 1) ? lua_tounsigned(l, 1) : SIZE_MAX;
+    lua_pushunsigned(l, Dispatcher::get(l).drain(max));
+    return 1;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Loader of the dispatcher module, register it with
+ *          registerModule<load_dispatcher>(l, "Dispatcher").
+ */
+inline int load_dispatcher(lua_State* l)
+{
+    lua_pushcfunction(l, dispatcher_drain);
+    lua_setfield(l, -2, "drain");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef INSTANCE_STATS_H
+#define INSTANCE_STATS_H
+
+/**
+ * Copyright (c) 2014 Domora
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/** Counters of the instances of each class, compiled only when
+ *  CPPLUA_ENABLE_INSTANCE_STATS is defined. Without it, the macros expand
+ *  to nothing and ClassInfo holds no counter.
+ *
+ *  With it, every userdata created with an ObjectHeader (constructors,
+ *  objects returned by value, borrowed or smart pointers) is counted in the
+ *  ClassInfo of its class, and uncounted by __gc. The bytes are the size
+ *  of the userdata: the header and the object built in it for the values,
+ *  the header and the smart pointer for the others. The counters belong to
+ *  the class, so they add up the instances of all the states.
+ *
+ *  The classes are named when they are registered (registerDestructor), the
+ *  instances of a class never registered are counted but not listed.
+ *
+ *  In C++: findInstanceStats("Class")->live.load()
+ *          dumpInstanceStats(stderr)
+ *  In Lua: require("Instances").get("Class").live
+ *          require("Instances").dump() --Sorted by bytes */
+
+#ifdef CPPLUA_ENABLE_INSTANCE_STATS
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "lua5.2/lua.h"
+#include "lua5.2/lualib.h"
+#include "lua5.2/lauxlib.h"
+}
+
+struct InstanceStats
+{
+    InstanceStats() :
+        live(0),
+        peak(0),
+        created(0),
+        bytes(0),
+        peak_bytes(0)
+    {}
+
+    InstanceStats(const InstanceStats&) = delete;
+    InstanceStats& operator=(const InstanceStats&) = delete;
+
+    /**
+     * \param 	size the size of the new userdata
+     * \author 	Stud
+     */
+    void add(uint64_t size)
+    {
+        created.fetch_add(1, std::memory_order_relaxed);
+        raise(peak, live.fetch_add(1, std::memory_order_relaxed) + 1);
+        raise(peak_bytes, bytes.fetch_add(size, std::memory_order_relaxed) + size);
+    }
+
+    /**
+     * \param 	size the size of the collected userdata
+     * \author 	Stud
+     */
+    void remove(uint64_t size)
+    {
+        live.fetch_sub(1, std::memory_order_relaxed);
+        bytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> live;
+    std::atomic<uint64_t> peak;
+    std::atomic<uint64_t> created;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> peak_bytes;
+
+private:
+    static void raise(std::atomic<uint64_t>& maximum, uint64_t value)
+    {
+        uint64_t current = maximum.load(std::memory_order_relaxed);
+        while(value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            ;
+    }
+};
+
+/** A copy of the counters of a class */
+struct InstanceReport
+{
+    std::string name;
+    uint64_t live;
+    uint64_t peak;
+    uint64_t created;
+    uint64_t bytes;
+    uint64_t peak_bytes;
+};
+
+/** The counters of the registered classes, indexed by their names */
+struct InstanceRegistry
+{
+    std::mutex mutex;
+    std::map<std::string, const InstanceStats*> classes;
+};
+
+inline InstanceRegistry& getInstanceRegistry()
+{
+    static InstanceRegistry registry;
+    return registry;
+}
+
+/**
+ * \param 	name the name of the class
+ * \param 	stats the counters of its ClassInfo
+ * \author 	Stud
+ * \brief 	Called when a class is registered, a class registered in several
+ *          states is listed once.
+ */
+inline void trackInstances(const std::string& name, const InstanceStats& stats)
+{
+    InstanceRegistry& registry = getInstanceRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.classes[name] = &stats;
+}
+
+/**
+ * \param 	name the name of the class
+ * \return 	its counters, NULL if it has never been registered
+ * \author 	Stud
+ */
+inline const InstanceStats* findInstanceStats(const std::string& name)
+{
+    InstanceRegistry& registry = getInstanceRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto it = registry.classes.find(name);
+    return it != registry.classes.end() ? it->second : NULL;
+}
+
+/**
+ * \return 	the counters of every registered class, the classes that use
+ *          the most memory first
+ * \author 	Stud
+ */
+inline std::vector<InstanceReport> reportInstances()
+{
+    std::vector<InstanceReport> reports;
+    {
+        InstanceRegistry& registry = getInstanceRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        reports.reserve(registry.classes.size());
+        for(auto it = registry.classes.begin(); it != registry.classes.end(); ++it)
+        {
+            const InstanceStats& stats = *it->second;
+            InstanceReport report = {
+                it->first,
+                stats.live.load(std::memory_order_relaxed),
+                stats.peak.load(std::memory_order_relaxed),
+                stats.created.load(std::memory_order_relaxed),
+                stats.bytes.load(std::memory_order_relaxed),
+                stats.peak_bytes.load(std::memory_order_relaxed)
+            };
+            reports.push_back(report);
+        }
+    }
+    std::stable_sort(reports.begin(), reports.end(), [](const InstanceReport& a, const InstanceReport& b) {
+        return a.bytes > b.bytes;
+    });
+    return reports;
+}
+
+/**
+ * \param 	f where the table is written
+ * \author 	Stud
+ * \brief 	Writes one line per class, sorted by bytes.
+ */
+inline void dumpInstanceStats(FILE* f)
+{
+    const std::vector<InstanceReport> reports = reportInstances();
+    fprintf(f, "%-24s %10s %10s %10s %12s %12s\n", "class", "live", "peak", "created", "bytes", "peak_bytes");
+    for(std::size_t i = 0; i < reports.size(); ++i)
+    {
+        const InstanceReport& r = reports[i];
+        fprintf(f, "%-24s %10llu %10llu %10llu %12llu %12llu\n", r.name.c_str(),
+                static_cast<unsigned long long>(r.live), static_cast<unsigned long long>(r.peak),
+                static_cast<unsigned long long>(r.created), static_cast<unsigned long long>(r.bytes),
+                static_cast<unsigned long long>(r.peak_bytes));
+    }
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	report the counters to push as a table
+ * \author 	Stud
+ */
+inline void pushInstanceReport(lua_State* l, const InstanceReport& report)
+{
+    lua_createtable(l, 0, 6);
+    lua_pushstring(l, report.name.c_str());
+    lua_setfield(l, -2, "name");
+    lua_pushnumber(l, lua_Number(report.live));
+    lua_setfield(l, -2, "live");
+    lua_pushnumber(l, lua_Number(report.peak));
+    lua_setfield(l, -2, "peak");
+    lua_pushnumber(l, lua_Number(report.created));
+    lua_setfield(l, -2, "created");
+    lua_pushnumber(l, lua_Number(report.bytes));
+    lua_setfield(l, -2, "bytes");
+    lua_pushnumber(l, lua_Number(report.peak_bytes));
+    lua_setfield(l, -2, "peak_bytes");
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Lua function Instances.get(name): the counters of the class, nil
+ *          if it has never been registered.
+ */
+inline int instance_stats_get(lua_State* l)
+{
+    const char* name = luaL_checkstring(l, 1);
+    const InstanceStats* stats = findInstanceStats(name);
+    if(stats == NULL)
+        return 0;
+    InstanceReport report = {
+        name,
+        stats->live.load(std::memory_order_relaxed),
+        stats->peak.load(std::memory_order_relaxed),
+        stats->created.load(std::memory_order_relaxed),
+        stats->bytes.load(std::memory_order_relaxed),
+        stats->peak_bytes.load(std::memory_order_relaxed)
+    };
+    pushInstanceReport(l, report);
+    return 1;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Lua function Instances.dump(): an array of the counters of each
+ *          class, sorted by bytes.
+ */
+inline int instance_stats_dump(lua_State* l)
+{
+    const std::vector<InstanceReport> reports = reportInstances();
+    lua_createtable(l, static_cast<int>(reports.size()), 0);
+    for(std::size_t i = 0; i < reports.size(); ++i)
+    {
+        pushInstanceReport(l, reports[i]);
+        lua_rawseti(l, -2, static_cast<int>(i + 1));
+    }
+    return 1;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Loader of the instances module, register it with
+ *          registerModule<load_instance_stats>(l, "Instances").
+ */
+inline int load_instance_stats(lua_State* l)
+{
+    lua_pushcfunction(l, instance_stats_get);
+    lua_setfield(l, -2, "get");
+    lua_pushcfunction(l, instance_stats_dump);
+    lua_setfield(l, -2, "dump");
+    return 0;
+}
+
+/** Counts a new userdata of size bytes of the class info */
+#define CPPLUA_INSTANCE_CREATED(info, size) (info).instances().add(size)
+
+/** Uncounts the userdata at index, collected by __gc */
+#define CPPLUA_INSTANCE_DESTROYED(l, index, header) \
+    do { \
+        if((header) != NULL) \
+            (header)->info->instances().remove(lua_rawlen(l, index)); \
+    } while(0)
+
+/** Lists the class under its name */
+#define CPPLUA_INSTANCE_TRACK(name, info) trackInstances(name, (info).instances())
+
+#else
+
+#define CPPLUA_INSTANCE_CREATED(info, size)
+#define CPPLUA_INSTANCE_DESTROYED(l, index, header) do {} while(0)
+#define CPPLUA_INSTANCE_TRACK(name, info)
+
+#endif
+
+#endif
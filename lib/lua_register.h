@@ -1,4 +1,4 @@
-﻿#ifndef REGISTER_H
+#ifndef REGISTER_H
 #define REGISTER_H
 
 /**
@@ -27,79 +27,56 @@ extern "C" {
 #include "primitives.h"
 #include "trait.h"
 #include "read_and_write.h"
+#include "call_stats.h"
 
 /**
-     * \param 	index index of the stack used to read the value.
-     * \return 	tuple filled with the values on the stack.
      * \author 	Stud
-     * \brief 	Method used to turn a parameter pack into a tuple of
-     * 			variables intialized with the values read on Lua's stack.
-     *
-     * 			Recursively calls itself until Rest is empty, then it'll call the
-     * 			stop function. At each recursion, concatenate the tuple and the
-     * 			new value and increment the index to read the correct value on
-     * 			the stack.
-     * 			SFINAE used, case T1 is not a reference.
+     * \brief 	Type used to store an argument read on Lua's stack before
+     * 			the call. Arguments are stored with their own type, except
+     * 			the const references to primitives that are read as a
+     * 			value and bound to the parameter during the call.
      */
-template <typename T1, typename T2, typename... Rest>
-inline typename std::enable_if<!std::is_reference<T1>::value, std::tuple<T1, T2, Rest...> >::type
-getArgs(lua_State* l, const int index)
-{
-    std::tuple<T1> head = std::make_tuple(read<T1>(l, index));
-    return std::tuple_cat(head, getArgs<T2, Rest...>(l, index + 1));
-}
-
-/**
-    * \param 	index index of the stack used to read the value.
-    * \return 	tuple filled with the values on the stack.
-    * \author 	Stud
-    * \brief 	Method used to turn a parameter pack into a tuple of
-    * 			variables intialized with the values read on Lua's stack.
-    *
-    * 			Recursively calls itself until Rest is empty, then it'll call the
-    * 			stop function. At each recursion, concatenate the tuple and the
-    * 			new value and increment the index to read the correct value on
-    * 			the stack.
-    * 			SFINAE used, case T1 is a reference.
-    */
-template <typename T1, typename T2, typename... Rest>
-inline typename std::enable_if<std::is_reference<T1>::value, std::tuple<T1&, T2, Rest...> >::type
-getArgs(lua_State* l, const int index)
-{
-    std::tuple<T1&> head = std::tie(read<T1&>(l, index));
-    return std::tuple_cat(head, getArgs<T2, Rest...>(l, index + 1));
-}
+template <typename T>
+struct arg_storage {
+    typedef T type;
+};
+
+template <typename T>
+struct arg_storage<const T&> {
+    typedef typename std::conditional<is_primitive<T>::value, T, const T&>::type type;
+};
 
 /**
-     * \param 	index index of the stack used to read the value.
-     * \return 	tuple filled with the value read on the stack.
+     * \param 	index index of the stack used to read the first value.
+     * \param 	_indices trait used to expand the parameter pack
+     * \return 	tuple filled with the values on the stack.
      * \author 	Stud
-     * \brief 	Build a tuple with a single variable intialized with the
-     * 			value on the stack. Used to concatenate several tuple in
-     * 			one tuple with several parameter.
-     * 			SFINAE used, case T1 is not a reference.
+     * \brief 	Method used to turn a parameter pack into a tuple of
+     * 			variables intialized with the values read on Lua's stack.
+     *
+     * 			Each value is read directly in its slot of the tuple, the
+     * 			braced initialization guarantees that the values are read
+     * 			from left to right.
      */
-template <typename T>
-inline typename std::enable_if<!std::is_reference<T>::value, std::tuple<T> >::type
-getArgs(lua_State* l, const int index)
+template <typename... Args, std::size_t... N>
+inline std::tuple<typename arg_storage<Args>::type...>
+getArgs(lua_State* l, const int index, _indices<N...>)
 {
-    return std::make_tuple(read<T>(l, index));
+    return std::tuple<typename arg_storage<Args>::type...>{
+        read<typename arg_storage<Args>::type>(l, index + N)...};
 }
 
 /**
-     * \param 	index index of the stack used to read the value.
-     * \return 	tuple filled with the value read on the stack.
+     * \param 	index index of the stack used to read the first value.
+     * \return 	tuple filled with the values on the stack.
      * \author 	Stud
-     * \brief 	Build a tuple with a single variable intialized with the
-     * 			value on the stack. Used to concatenate several tuple in
-     * 			one tuple with several parameter.
-     * 			SFINAE used, case T1 is a reference.
+     * \brief 	Starts the process of reading the parameter pack.
      */
-template <typename T>
-inline typename std::enable_if<std::is_reference<T>::value, std::tuple<T> >::type
+template <typename... Args>
+inline std::tuple<typename arg_storage<Args>::type...>
 getArgs(lua_State* l, const int index)
 {
-    return std::tie(read<T&>(l, index));
+    return getArgs<Args...>(l, index, typename _indices_builder<sizeof...(Args)>::type());
 }
 
 /**
@@ -111,10 +88,10 @@ getArgs(lua_State* l, const int index)
      * 				that hold all of the arguments.
      * */
 template <typename ClassName, typename... Args, std::size_t... N>
-inline ClassName* instantiate(lua_State* l, std::tuple<Args...> args, _indices<N...>)
+inline ClassName* instantiate(lua_State* l, std::tuple<Args...>&& args, _indices<N...>)
 {
-    void* data = lua_newuserdata(l, sizeof(ClassName));
-    return new(data) ClassName(std::get<N>(args)...);
+    void* data = newObject<ClassName>(l);
+    return new(data) ClassName(std::get<N>(std::move(args))...);
 }
 
 /**
@@ -125,9 +102,9 @@ inline ClassName* instantiate(lua_State* l, std::tuple<Args...> args, _indices<N
      * 				an object of class ClassName.
      * */
 template <typename ClassName, typename... Args>
-inline ClassName* instantiate(lua_State* l, std::tuple<Args...> args)
+inline ClassName* instantiate(lua_State* l, std::tuple<Args...>&& args)
 {
-    return instantiate<ClassName>(l, args,
+    return instantiate<ClassName>(l, std::move(args),
     typename _indices_builder<sizeof...(Args)>::type());
 }
 
@@ -142,14 +119,14 @@ inline ClassName* instantiate(lua_State* l, std::tuple<Args...> args)
      * 				SFINAE used, case non void return (what is returned
      * 				is pushed on the Lua stack).
      * */
-template <typename Ret, typename ClassName, typename... Args, std::size_t... N>
+template <typename Ret, typename ClassName, typename... Args, typename... Stored, std::size_t... N>
 inline typename std::enable_if<!std::is_void<Ret>::value>::type
 callFunctionWithTuple(lua_State* l, Ret (ClassName::*fun)(Args...),
-          std::tuple<Args...> args,
+          std::tuple<Stored...>&& args,
           _indices<N...>)
 {
-    ClassName * obj = l_checkClass<ClassName>(l, 1);
-    push(l, (obj->*fun)(std::get<N>(args)...));
+    ClassName * obj = &l_checkClassRef<ClassName>(l, 1);
+    push(l, (obj->*fun)(std::get<N>(std::move(args))...));
 }
 
 /**
@@ -162,14 +139,14 @@ callFunctionWithTuple(lua_State* l, Ret (ClassName::*fun)(Args...),
      * 				SFINAE used, case void return (there is nothing to
      * 				push on the Lua stack).
      * */
-template <typename Ret, typename ClassName, typename... Args, std::size_t... N>
+template <typename Ret, typename ClassName, typename... Args, typename... Stored, std::size_t... N>
 inline typename std::enable_if<std::is_void<Ret>::value>::type
 callFunctionWithTuple(lua_State* l, Ret (ClassName::*fun)(Args...),
-          std::tuple<Args...> args,
+          std::tuple<Stored...>&& args,
           _indices<N...>)
 {
-    ClassName * obj = l_checkClass<ClassName>(l, 1);
-    (obj->*fun)(std::get<N>(args)...);
+    ClassName * obj = &l_checkClassRef<ClassName>(l, 1);
+    (obj->*fun)(std::get<N>(std::move(args))...);
 }
 
 /**
@@ -183,7 +160,7 @@ template <typename Ret, typename ClassName>
 inline typename std::enable_if<std::is_void<Ret>::value>::type
 callFunctionWithLua(lua_State* l, Ret (ClassName::*fun)(lua_State*))
 {
-    ClassName * obj = l_checkClass<ClassName>(l, 1);
+    ClassName * obj = &l_checkClassRef<ClassName>(l, 1);
     (obj->*fun)(l);
 }
 
@@ -198,7 +175,7 @@ template <typename Ret, typename ClassName>
 inline typename std::enable_if<!std::is_void<Ret>::value>::type
 callFunctionWithLua(lua_State* l, Ret (ClassName::*fun)(lua_State*))
 {
-    ClassName * obj = l_checkClass<ClassName>(l, 1);
+    ClassName * obj = &l_checkClassRef<ClassName>(l, 1);
     push(l, (obj->*fun)(l));
 }
 
@@ -209,10 +186,10 @@ callFunctionWithLua(lua_State* l, Ret (ClassName::*fun)(lua_State*))
      * 	\brief 		Starts the process of expanding the tuple to call
      * 				the function pointed by the first parameter.
      * */
-template <typename Ret, typename ClassName, typename... Args>
+template <typename Ret, typename ClassName, typename... Args, typename... Stored>
 inline void callFunctionWithTuple(lua_State* l, Ret (ClassName::*fun)(Args...),
-          std::tuple<Args...> args) {
-    callFunctionWithTuple(l, fun, args, typename _indices_builder<sizeof...(Args)>::type());
+          std::tuple<Stored...>&& args) {
+    callFunctionWithTuple(l, fun, std::move(args), typename _indices_builder<sizeof...(Args)>::type());
 }
 
 /**
@@ -226,13 +203,13 @@ inline void callFunctionWithTuple(lua_State* l, Ret (ClassName::*fun)(Args...),
      * 				SFINAE used, case non void return (what is returned
      * 				is pushed on the Lua stack).
      * */
-template <typename Ret, typename... Args, std::size_t... N>
+template <typename Ret, typename... Args, typename... Stored, std::size_t... N>
 inline typename std::enable_if<!std::is_void<Ret>::value>::type
 callFunctionWithTuple(lua_State* l, Ret (fun)(Args...),
-          std::tuple<Args...> args,
+          std::tuple<Stored...>&& args,
           _indices<N...>)
 {
-    push(l, (fun)(std::get<N>(args)...));
+    push(l, (fun)(std::get<N>(std::move(args))...));
 }
 
 /**
@@ -245,13 +222,13 @@ callFunctionWithTuple(lua_State* l, Ret (fun)(Args...),
      * 				SFINAE used, case void return (there is nothing to
      * 				push on the Lua stack).
      * */
-template <typename Ret, typename... Args, std::size_t... N>
+template <typename Ret, typename... Args, typename... Stored, std::size_t... N>
 inline typename std::enable_if<std::is_void<Ret>::value>::type
 callFunctionWithTuple(lua_State* , Ret (fun)(Args...),
-          std::tuple<Args...> args,
+          std::tuple<Stored...>&& args,
           _indices<N...>)
 {
-    (fun)(std::get<N>(args)...);
+    (fun)(std::get<N>(std::move(args))...);
 }
 
 /**
@@ -261,10 +238,10 @@ callFunctionWithTuple(lua_State* , Ret (fun)(Args...),
      * 	\brief 		Starts the process of expanding the tuple to call
      * 				the function pointed by the first parameter.
      * */
-template <typename Ret, typename... Args>
+template <typename Ret, typename... Args, typename... Stored>
 inline void callFunctionWithTuple(lua_State* l, Ret(fun)(Args...),
-          std::tuple<Args...> args) {
-    callFunctionWithTuple(l, fun, args, typename _indices_builder<sizeof...(Args)>::type());
+          std::tuple<Stored...>&& args) {
+    callFunctionWithTuple(l, fun, std::move(args), typename _indices_builder<sizeof...(Args)>::type());
 }
 
 /**
@@ -280,7 +257,7 @@ inline typename std::enable_if<!std::is_void<Ret>::value>::type
 callFunction(lua_State* l, Ret (ClassName::*fun)())
 {
     //Get the instance on the stack and call the function
-    ClassName * obj = l_checkClass<ClassName>(l, 1);
+    ClassName * obj = &l_checkClassRef<ClassName>(l, 1);
     push(l, (obj->*fun)());
 }
 
@@ -296,7 +273,7 @@ inline typename std::enable_if<std::is_void<Ret>::value>::type
 callFunction(lua_State* l, Ret (ClassName::*fun)())
 {
     //Get the instance on the stack and call the function
-    ClassName * obj = l_checkClass<ClassName>(l, 1);
+    ClassName * obj = &l_checkClassRef<ClassName>(l, 1);
     (obj->*fun)();
 }
 
@@ -330,6 +307,208 @@ callFunction(lua_State* l, Ret (fun)())
 }
 
 
+/**
+ * \return 	the number of parameters that must be given, the trailing
+ *          optional parameters accept no value at all
+ * \author 	Stud
+ */
+template <typename... Args>
+constexpr int required_count()
+{
+    const bool optional[] = { false, (lua_arg<typename std::decay<Args>::type>::mask & lua_type_bit(LUA_TNONE)) != 0 ... };
+    int count = sizeof...(Args);
+    while(count > 0 && optional[count])
+        --count;
+    return count;
+}
+
+/**
+ * \author 	Stud
+ * \brief 	Signature of a bound function, used to find which function of
+ *          an overload set matches the values on the stack.
+ */
+template <typename... Args>
+struct signature
+{
+    static constexpr int min_count = required_count<Args...>();
+    static constexpr int max_count = sizeof...(Args);
+
+    /**
+     * \param 	l lua_State*
+     * \param 	index index of the first argument on the stack
+     * \return 	true if the values on the stack can be read as Args
+     * \author 	Stud
+     * \brief 	Too many values never match. A missing value is LUA_TNONE,
+     *          which only matches an optional parameter.
+     */
+    static bool match(lua_State* l, const int index)
+    {
+        if(lua_gettop(l) - index + 1 > static_cast<int>(sizeof...(Args)))
+            return false;
+        return match(l, index, typename _indices_builder<sizeof...(Args)>::type());
+    }
+
+    //Stops at the first argument that does not match
+    template <std::size_t... N>
+    static bool match(lua_State* l, const int index, _indices<N...>)
+    {
+        bool matches = true;
+        const bool checked[] = { true, (matches = matches && check_arg<Args>(l, index + N))... };
+        (void)checked;
+        return matches;
+    }
+};
+
+/**
+ * \author 	Stud
+ * \brief 	Signature of a function that reads the stack itself, any number
+ *          of values matches (max_count is -1).
+ */
+struct stack_signature
+{
+    static constexpr int min_count = 0;
+    static constexpr int max_count = -1;
+};
+
+/**
+ * \param 	l lua_State*
+ * \param 	field name of the table in the metatable ("_methods" or "_attributes")
+ * \param 	name name of the element in the Lua environment
+ * \author 	Stud
+ * \brief 	Pops the value on top of the stack and stores it in one of the
+ *          flattened tables of the class whose metatable is right under it.
+ */
+inline void set_class_element(lua_State* l, const char* field, const char* name)
+{
+    //Get the table of the metatable
+    lua_pushstring(l, field);
+    lua_rawget(l, -3);
+    //Put the value on top of the name and the table
+    lua_pushstring(l, name);
+    lua_pushvalue(l, -3);
+    lua_rawset(l, -3);
+    //Remove the table and the value
+    lua_pop(l, 2);
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	name name of the method in the Lua environment
+ * \author 	Stud
+ * \brief 	Pops the function on top of the stack and adds it to the method
+ *          table of the class being registered.
+ */
+inline void set_method(lua_State* l, const char* name)
+{
+    set_class_element(l, "_methods", name);
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	name name of the attribute in the Lua environment
+ * \author 	Stud
+ * \brief 	Pops the accessor on top of the stack and adds it to the attribute
+ *          table of the class being registered.
+ */
+inline void set_attribute(lua_State* l, const char* name)
+{
+    set_class_element(l, "_attributes", name);
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	methods the registration table of the class: the names and the
+ *          wrappers, for example {"get_name", METHOD(Class::get_name)::call}
+ * \author 	Stud
+ * \brief 	Adds all the methods to the method table of the class being
+ *          registered in one pass. The table can be constexpr, nothing is
+ *          built at runtime except the Lua strings.
+ */
+template <std::size_t N>
+void registerMethods(lua_State* l, const luaL_Reg (&methods)[N])
+{
+    lua_pushstring(l, "_methods");
+    lua_rawget(l, -2);
+    for(std::size_t i = 0; i < N; ++i)
+    {
+        lua_pushcfunction(l, methods[i].func);
+        lua_setfield(l, -2, methods[i].name);
+    }
+    lua_pop(l, 1);
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	functions the names and the wrappers, for example
+ *          {"get_ten", STATICMETHOD(Class::get_ten)::call}
+ * \author 	Stud
+ * \brief 	Adds all the functions to the table on top of the stack: a
+ *          module or the constructor table of a class (static functions).
+ */
+template <std::size_t N>
+void registerFunctions(lua_State* l, const luaL_Reg (&functions)[N])
+{
+    for(std::size_t i = 0; i < N; ++i)
+    {
+        lua_pushcfunction(l, functions[i].func);
+        lua_setfield(l, -2, functions[i].name);
+    }
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	f the wrapper
+ * \param 	name name of the function in the Lua environment
+ * \author 	Stud
+ * \brief 	Push the wrapper of a bound function. With CPPLUA_ENABLE_STATS
+ *          its counters are given as upvalue, see call_stats.h.
+ */
+inline void pushBoundFunction(lua_State* l, lua_CFunction f, const char* name)
+{
+#ifdef CPPLUA_ENABLE_STATS
+    lua_pushlightuserdata(l, getCallStats(l, name));
+    lua_pushcclosure(l, f, 1);
+#else
+    (void)name;
+    lua_pushcfunction(l, f);
+#endif
+}
+
+/**
+ * \brief 	Same as pushBoundFunction for a method, the counters are named
+ *          after the class and the method.
+ */
+template <typename ClassName>
+void pushBoundMethod(lua_State* l, lua_CFunction f, const char* name)
+{
+#ifdef CPPLUA_ENABLE_STATS
+    pushBoundFunction(l, f, (getClassName<ClassName>() + "." + name).c_str());
+#else
+    pushBoundFunction(l, f, name);
+#endif
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	f the call of the overload set
+ * \param 	name name of the counters
+ * \author 	Stud
+ * \brief 	Same as pushBoundFunction for an overload set. The counters are
+ *          the second upvalue and the first one is nil, so that only the
+ *          set is measured and not the overload it calls.
+ */
+inline void pushBoundOverloads(lua_State* l, lua_CFunction f, const char* name)
+{
+#ifdef CPPLUA_ENABLE_STATS
+    lua_pushnil(l);
+    lua_pushlightuserdata(l, getCallStats(l, name));
+    lua_pushcclosure(l, f, 2);
+#else
+    (void)name;
+    lua_pushcfunction(l, f);
+#endif
+}
+
 /**	\brief Struct used to expose member function 
  *
  * */
@@ -347,24 +526,34 @@ template<typename MethodType, MethodType> struct registerMemberFunction;
 template<typename ClassName, typename ReturnType, typename ...Args, ReturnType (ClassName::*method)(Args...)>
 struct registerMemberFunction<ReturnType (ClassName::*)(Args...), method>
 {
-    static void push(lua_State* l, std::string name)
+    typedef ClassName class_type;
+
+    static int call(lua_State* l)
     {
-        lua_pushstring(l, name.c_str());
-        lua_pushcfunction(l, [](lua_State* l) {
-            lua_pushcfunction(l, [](lua_State* l) {
-                //Create a tuple from the variadic template and initialize
-                //The variables with the values on the stack
-                std::tuple<Args...> args = getArgs<Args...>(l, 2);
-                //Clean the stack
-                lua_settop(l, - (sizeof...(Args) + 1));
-                //Unpack the tuple, calls the function and push the result
-                callFunctionWithTuple(l, method, args);
-                return 1;
-            });
-            return 1;
-        });
-        //Link the lambda function with the name
-        lua_rawset(l, -3);
+        CPPLUA_PROBE(l);
+        //Check self before the tuple exists, a wrong self raises an error
+        l_checkClassRef<ClassName>(l, 1);
+        //Create a tuple from the variadic template and initialize
+        //The variables with the values on the stack
+        auto args = getArgs<Args...>(l, 2);
+        //Unpack the tuple, calls the function and push the result
+        callFunctionWithTuple(l, method, std::move(args));
+        return return_count<ReturnType>::value;
+    }
+
+    typedef signature<Args...> arguments;
+    static constexpr int first_arg = 2;
+
+    static bool match(lua_State* l)
+    {
+        return arguments::match(l, first_arg);
+    }
+
+    static void push(lua_State* l, const char* name)
+    {
+        pushBoundMethod<ClassName>(l, call, name);
+        //Link the function with the name in the method table
+        set_method(l, name);
     }
 };
 
@@ -378,18 +567,29 @@ struct registerMemberFunction<ReturnType (ClassName::*)(Args...), method>
 template<typename ClassName, typename ReturnType, ReturnType (ClassName::*method)(lua_State*)>
 struct registerMemberFunction<ReturnType (ClassName::*)(lua_State*), method>
 {
-    static void push(lua_State* l, std::string name)
+    typedef ClassName class_type;
+
+    static int call(lua_State* l)
     {
-        lua_pushstring(l, name.c_str());
-        lua_pushcfunction(l, [](lua_State* l) {
-            lua_pushcfunction(l, [](lua_State* l) {
-                callFunctionWithLua(l, method);
-                return 1;
-            });
-            return 1;
-        });
-        //Link the lambda function with the name
-        lua_rawset(l, -3);
+        CPPLUA_PROBE(l);
+        callFunctionWithLua(l, method);
+        return return_count<ReturnType>::value;
+    }
+
+    //The function reads the stack itself, it matches any value
+    typedef stack_signature arguments;
+    static constexpr int first_arg = 2;
+
+    static bool match(lua_State*)
+    {
+        return true;
+    }
+
+    static void push(lua_State* l, const char* name)
+    {
+        pushBoundMethod<ClassName>(l, call, name);
+        //Link the function with the name in the method table
+        set_method(l, name);
     }
 };
 
@@ -406,23 +606,29 @@ struct registerMemberFunction<ReturnType (ClassName::*)(lua_State*), method>
 template<typename ClassName, typename ReturnType, ReturnType (ClassName::*method)(void)>
 struct registerMemberFunction<ReturnType (ClassName::*)(void), method>
 {
-    static void push(lua_State* l, std::string name)
+    typedef ClassName class_type;
+
+    static int call(lua_State* l)
     {
-        lua_pushstring(l, name.c_str());
-        lua_pushcfunction(l, [](lua_State* l) {
-            //Simply register a lambda that calls the function
-            lua_pushcfunction(l, [](lua_State* l) {
-                //Clean the stack
-                lua_settop(l, -1);
-                //Call the function without arguments
-                callFunction(l, method);
+        CPPLUA_PROBE(l);
+        //Call the function without arguments
+        callFunction(l, method);
+        return return_count<ReturnType>::value;
+    }
 
-                return 1;
-            });
-            return 1;
-        });
-        //Link the lambda function with the name
-        lua_rawset(l, -3);
+    typedef signature<> arguments;
+    static constexpr int first_arg = 2;
+
+    static bool match(lua_State* l)
+    {
+        return arguments::match(l, first_arg);
+    }
+
+    static void push(lua_State* l, const char* name)
+    {
+        pushBoundMethod<ClassName>(l, call, name);
+        //Link the function with the name in the method table
+        set_method(l, name);
     }
 };
 
@@ -443,20 +649,30 @@ template<typename F, F f> struct registerStaticFunction;
 template<typename Ret, typename ...Args, Ret(*f)(Args...)>
 struct registerStaticFunction<Ret(*)(Args...), f>
 {
-    static void push(lua_State* l, std::string name)
-    {
-        lua_pushcfunction(l, [](lua_State* l) {
-            //Create a tuple from the variadic template and initialize
-            //The variables with the values on the stack
-            std::tuple<Args...> args = getArgs<Args...>(l, 1);
-            //Clean the stack
-            lua_settop(l, - (sizeof...(Args) + 1));
-            //Unpack the tuple, calls the function and push the result
-            callFunctionWithTuple(l, f, args);
-            return 1;
-        });
-        //Link the lambda function with the name
-        lua_setfield(l, -2, name.c_str());
+    static int call(lua_State* l)
+    {
+        CPPLUA_PROBE(l);
+        //Create a tuple from the variadic template and initialize
+        //The variables with the values on the stack
+        auto args = getArgs<Args...>(l, 1);
+        //Unpack the tuple, calls the function and push the result
+        callFunctionWithTuple(l, f, std::move(args));
+        return return_count<Ret>::value;
+    }
+
+    typedef signature<Args...> arguments;
+    static constexpr int first_arg = 1;
+
+    static bool match(lua_State* l)
+    {
+        return arguments::match(l, first_arg);
+    }
+
+    static void push(lua_State* l, const char* name)
+    {
+        pushBoundFunction(l, call, name);
+        //Link the function with the name
+        lua_setfield(l, -2, name);
     }
 };
 
@@ -473,15 +689,27 @@ struct registerStaticFunction<Ret(*)(Args...), f>
 template<typename Ret, Ret(*f)(void)>
 struct registerStaticFunction<Ret(*)(void), f>
 {
-    static void push(lua_State* l, std::string name)
+    static int call(lua_State* l)
+    {
+        CPPLUA_PROBE(l);
+        //Calls the function and push the result
+        callFunction(l, f);
+        return return_count<Ret>::value;
+    }
+
+    typedef signature<> arguments;
+    static constexpr int first_arg = 1;
+
+    static bool match(lua_State* l)
+    {
+        return arguments::match(l, first_arg);
+    }
+
+    static void push(lua_State* l, const char* name)
     {
-        lua_pushcfunction(l, [](lua_State* l) {
-            //Calls the function and push the result
-            callFunction(l, f);
-            return 1;
-        });
-        //Link the lambda function with the name
-        lua_setfield(l, -2, name.c_str());
+        pushBoundFunction(l, call, name);
+        //Link the function with the name
+        lua_setfield(l, -2, name);
     }
 };
 
@@ -502,20 +730,30 @@ template<typename F, F f> struct registerCFunction;
 template<typename Ret, typename ...Args, Ret(*f)(Args...)>
 struct registerCFunction<Ret(*)(Args...), f>
 {
-    static void push(lua_State* l, std::string name)
-    {
-        lua_pushcfunction(l , [](lua_State* l) {
-            //Create a tuple from the variadic template and initialize
-            //The variables with the values on the stack
-            std::tuple<Args...> args = getArgs<Args...>(l, 1 + 1);//There is always a this from js
-            //Clean the stack
-            lua_settop(l, - (sizeof...(Args) + 1 + 1));//There is always a this from js
-            //Unpack the tuple, calls the function and push the result
-            callFunctionWithTuple(l, f, args);
-            return 1;
-        });
-        //Link the lambda function with the name
-        lua_setfield(l, -2, name.c_str());
+    static int call(lua_State* l)
+    {
+        CPPLUA_PROBE(l);
+        //Create a tuple from the variadic template and initialize
+        //The variables with the values on the stack
+        auto args = getArgs<Args...>(l, 1 + 1);//There is always a this from js
+        //Unpack the tuple, calls the function and push the result
+        callFunctionWithTuple(l, f, std::move(args));
+        return return_count<Ret>::value;
+    }
+
+    typedef signature<Args...> arguments;
+    static constexpr int first_arg = 1 + 1;//There is always a this from js
+
+    static bool match(lua_State* l)
+    {
+        return arguments::match(l, first_arg);
+    }
+
+    static void push(lua_State* l, const char* name)
+    {
+        pushBoundFunction(l, call, name);
+        //Link the function with the name
+        lua_setfield(l, -2, name);
     }
 };
 
@@ -532,77 +770,515 @@ struct registerCFunction<Ret(*)(Args...), f>
 template<typename Ret, Ret(*f)(void)>
 struct registerCFunction<Ret(*)(void), f>
 {
-    static void push(lua_State* l, std::string name)
+    static int call(lua_State* l)
+    {
+        CPPLUA_PROBE(l);
+        //Calls the function and push the result
+        callFunction(l, f);
+        return return_count<Ret>::value;
+    }
+
+    typedef signature<> arguments;
+    static constexpr int first_arg = 1 + 1;//There is always a this from js
+
+    static bool match(lua_State* l)
+    {
+        return arguments::match(l, first_arg);
+    }
+
+    static void push(lua_State* l, const char* name)
     {
-        lua_pushcfunction(l, [](lua_State* l) {
-            //Calls the function and push the result
-            callFunction(l, f);
-            return 1;
-        });
-        //Link the lambda function with the name
-        lua_setfield(l, -2, name.c_str());
+        pushBoundFunction(l, call, name);
+        //Link the function with the name
+        lua_setfield(l, -2, name);
     }
 };
 
-template<typename Type, typename ClassName, Type ClassName::* t>
-void registerAttribute(lua_State* l, std::string name)
+/**
+     * 	\param 		f the callable object
+     * 	\param		args tuple filled with initialized arguments
+     * 	\param 		_indices trait used to unpack the tuple
+     * 	\author 	Stud
+     * 	\brief 		Expands the tuple to call the callable object.
+     * 				SFINAE used, case non void return (what is returned
+     * 				is pushed on the Lua stack).
+     * */
+template <typename Ret, typename F, typename... Stored, std::size_t... N>
+inline typename std::enable_if<!std::is_void<Ret>::value>::type
+callFunctorWithTuple(lua_State* l, F& f, std::tuple<Stored...>&& args, _indices<N...>)
 {
-    lua_pushcfunction(l, [](lua_State* l) {
-        ClassName *obj = l_checkClass<ClassName>(l, 1);
-        if(lua_gettop(l) == 1)
-        {
-            if(obj != nullptr)
-                push(l, obj->*t);
-        }
-        else
-            obj->*t = read<Type>(l, 2);
-        return 1;
-    });
-    //Link the lambda function with the name
-    lua_setfield(l, -2, name.c_str());
+    push(l, f(std::get<N>(std::move(args))...));
+}
+
+/**
+     * 	\param 		f the callable object
+     * 	\param		args tuple filled with initialized arguments
+     * 	\param 		_indices trait used to unpack the tuple
+     * 	\author 	Stud
+     * 	\brief 		Expands the tuple to call the callable object.
+     * 				SFINAE used, case void return (there is nothing to
+     * 				push on the Lua stack).
+     * */
+template <typename Ret, typename F, typename... Stored, std::size_t... N>
+inline typename std::enable_if<std::is_void<Ret>::value>::type
+callFunctorWithTuple(lua_State*, F& f, std::tuple<Stored...>&& args, _indices<N...>)
+{
+    f(std::get<N>(std::move(args))...);
 }
 
 /**
- * \param 	Ret (*)(Args...)) the function pointer
  * \author 	Stud
- * \brief 	Avoids the user to write the templates
+ * \brief 	Gives the signature of a callable object (lambda, functor or
+ *          function pointer) through its operator().
  */
-template<typename Ret, typename... Args>
-auto deduceFunction(Ret (*)(Args...)) -> Ret(*)(Args...)
-{}
+template <typename F, int first, typename Ret, typename... Args>
+struct functorCall;
+
+template <typename F>
+struct functor_traits : functor_traits<decltype(&F::operator())> {};
+
+template <typename Ret, typename... Args>
+struct functor_traits<Ret (*)(Args...)> {
+    template <typename F, int first>
+    using caller = functorCall<F, first, Ret, Args...>;
+};
+
+template <typename C, typename Ret, typename... Args>
+struct functor_traits<Ret (C::*)(Args...)> : functor_traits<Ret (*)(Args...)> {};
+
+template <typename C, typename Ret, typename... Args>
+struct functor_traits<Ret (C::*)(Args...) const> : functor_traits<Ret (*)(Args...)> {};
 
 /**
- * \param 	ReturnType (ClassName::*)(Args...) the function pointer
- * \author 	Marc
- * \brief 	Avoids the user to write the templates
+ * \author 	Stud
+ * \brief 	The C function pushed for a callable object. The object is
+ *          stored in the userdata in the first upvalue, the arguments
+ *          start at the index first.
  */
-template<typename ClassName, typename ReturnType, typename... Args>
-auto deduceMethod(ReturnType (ClassName::*)(Args...)) -> ReturnType (ClassName::*)(Args...)
-{}
+template <typename F, int first, typename Ret, typename... Args>
+struct functorCall
+{
+    static int call(lua_State* l)
+    {
+        F* f = static_cast<F*>(lua_touserdata(l, lua_upvalueindex(1)));
+        //Create a tuple from the variadic template and initialize
+        //The variables with the values on the stack
+        auto args = getArgs<Args...>(l, first);
+        //Unpack the tuple, calls the object and push the result
+        callFunctorWithTuple<Ret>(l, *f, std::move(args), typename _indices_builder<sizeof...(Args)>::type());
+        return return_count<Ret>::value;
+    }
+
+    typedef signature<Args...> arguments;
+    static constexpr int first_arg = first;
+
+    static bool match(lua_State* l)
+    {
+        return arguments::match(l, first_arg);
+    }
+};
 
 /**
  * \author 	Stud
- * \brief 	use MODULEFUNCTION(Func)::push(State, "name"); to register a module function
+ * \brief 	The C function pushed for a member function pointer known at
+ *          runtime. The pointer is stored in the userdata in the first
+ *          upvalue.
  */
-#define MODULEFUNCTION(m) registerCFunction<decltype(deduceFunction(&m)), &m>
+template <typename ClassName, typename Ret, typename... Args>
+struct memberPointerCall
+{
+    typedef Ret (ClassName::*Method)(Args...);
+
+    static int call(lua_State* l)
+    {
+        Method method = *static_cast<Method*>(lua_touserdata(l, lua_upvalueindex(1)));
+        l_checkClassRef<ClassName>(l, 1);
+        auto args = getArgs<Args...>(l, 2);
+        callFunctionWithTuple(l, method, std::move(args));
+        return return_count<Ret>::value;
+    }
+
+    typedef signature<Args...> arguments;
+    static constexpr int first_arg = 2;
+
+    static bool match(lua_State* l)
+    {
+        return arguments::match(l, first_arg);
+    }
+};
 
 /**
+ * \return 	the key of the metatable used to destroy the objects of type F
  * \author 	Stud
- * \brief 	use STATICFUNCTION(Class::Func)::push(State, "name"); to register a static function
  */
-#define STATICMETHOD(m) registerStaticFunction<decltype(deduceFunction(&m)), &m>
+template <typename F>
+const void* getFunctorKey()
+{
+    static const char key = 0;
+    return &key;
+}
 
 /**
- * \author 	Marc
- * \brief 	use METHOD(Class::Func)::push(State, "name"); to register a function
+ * \param 	l lua_State*
+ * \param 	f the object to store
+ * \author 	Stud
+ * \brief 	Push a userdata that holds a copy of f. The userdata only gets
+ *          a metatable with __gc when F has a destructor to call.
  */
-#define METHOD(m) registerMemberFunction<decltype(deduceMethod(&m)), &m>
+template <typename F>
+void pushFunctorData(lua_State* l, F&& f)
+{
+    typedef typename std::decay<F>::type Type;
+    void* data = lua_newuserdata(l, sizeof(Type));
+    new(data) Type(std::forward<F>(f));
+    if(!std::is_trivially_destructible<Type>::value)
+    {
+        lua_rawgetp(l, LUA_REGISTRYINDEX, getFunctorKey<Type>());
+        if(lua_isnil(l, -1))
+        {
+            lua_pop(l, 1);
+            lua_createtable(l, 0, 1);
+            lua_pushcfunction(l, [](lua_State* l) {
+                static_cast<Type*>(lua_touserdata(l, 1))->~Type();
+                return 0;
+            });
+            lua_setfield(l, -2, "__gc");
+            lua_pushvalue(l, -1);
+            lua_rawsetp(l, LUA_REGISTRYINDEX, getFunctorKey<Type>());
+        }
+        lua_setmetatable(l, -2);
+    }
+}
 
 /**
  * \param 	l lua_State*
+ * \param 	f the callable object (lambda, functor or function pointer)
  * \author 	Stud
- * \brief 	function used to register class constructor.
- * 			SFINAE, case where constructor needs arguments.
+ * \brief 	Push a C closure that calls f. first is the index of the first
+ *          argument on the stack.
+ */
+template <int first, typename F>
+void pushFunctor(lua_State* l, F&& f)
+{
+    typedef typename std::decay<F>::type Type;
+    pushFunctorData(l, std::forward<F>(f));
+    lua_pushcclosure(l, functor_traits<Type>::template caller<Type, first>::call, 1);
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	name name of the function in the Lua environment
+ * \param 	f the callable object (lambda, functor or function pointer)
+ * \author 	Stud
+ * \brief 	Expose a callable object known at runtime, like a static function.
+ *          The object is stored in the closure, there is no global state.
+ */
+template <typename F>
+void registerFunctor(lua_State* l, const char* name, F&& f)
+{
+    pushFunctor<1>(l, std::forward<F>(f));
+    lua_setfield(l, -2, name);
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	name name of the function in the Lua environment
+ * \param 	f the callable object (lambda, functor or function pointer)
+ * \author 	Stud
+ * \brief 	Expose a callable object known at runtime, like a module function.
+ */
+template <typename F>
+void registerModuleFunctor(lua_State* l, const char* name, F&& f)
+{
+    pushFunctor<1 + 1>(l, std::forward<F>(f));//There is always a this from js
+    lua_setfield(l, -2, name);
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	name name of the function in the Lua environment
+ * \param 	method the member function pointer
+ * \author 	Stud
+ * \brief 	Expose a member function pointer known at runtime.
+ */
+template <typename ClassName, typename Ret, typename... Args>
+void registerMemberPointer(lua_State* l, const char* name, Ret (ClassName::*method)(Args...))
+{
+    pushFunctorData(l, method);
+    lua_pushcclosure(l, memberPointerCall<ClassName, Ret, Args...>::call, 1);
+    set_method(l, name);
+}
+
+/**
+ * \return 	the highest stack top an overload with a bounded signature
+ *          accepts
+ * \author 	Stud
+ */
+template <typename... Overloads>
+constexpr int overload_last_top()
+{
+    const int tops[] = { 0, (Overloads::arguments::max_count < 0 ? 0 : Overloads::first_arg - 1 + Overloads::arguments::max_count)... };
+    int last = 0;
+    for(int top : tops)
+    {
+        if(top > last)
+            last = top;
+    }
+    return last;
+}
+
+/**
+ * \author 	Stud
+ * \brief 	The overloads to test for each stack top, in the order of the
+ *          overload set. The last bucket is for the tops above all the
+ *          bounded signatures.
+ */
+template <std::size_t Buckets, std::size_t Count>
+struct overload_table
+{
+    std::size_t size[Buckets];
+    std::size_t index[Buckets][Count];
+};
+
+/**
+ * \return 	the table of the overload set, built at compile time
+ * \author 	Stud
+ * \brief 	An overload is in the bucket of every stack top between its
+ *          required and its total number of parameters, a function that
+ *          reads the stack itself is in all of them.
+ */
+template <typename... Overloads>
+constexpr overload_table<overload_last_top<Overloads...>() + 2, sizeof...(Overloads)> make_overload_table()
+{
+    constexpr int last = overload_last_top<Overloads...>();
+    const int lowest[] = { Overloads::first_arg - 1 + Overloads::arguments::min_count... };
+    const int highest[] = { Overloads::arguments::max_count < 0 ? last + 1 : Overloads::first_arg - 1 + Overloads::arguments::max_count... };
+    overload_table<last + 2, sizeof...(Overloads)> table = {};
+    for(int top = 0; top <= last + 1; ++top)
+    {
+        for(std::size_t i = 0; i < sizeof...(Overloads); ++i)
+        {
+            if(lowest[i] <= top && top <= highest[i])
+                table.index[top][table.size[top]++] = i;
+        }
+    }
+    return table;
+}
+
+/**
+ * \author 	Stud
+ * \brief 	Calls the first function of the overload set whose signature
+ *          matches the values on the stack. The number of values selects a
+ *          bucket of a table built at compile time, only the overloads of
+ *          that bucket compare the Lua types. The order of the functions is
+ *          the order of the template parameters.
+ */
+template<typename... Overloads>
+struct overloadSet
+{
+    static int call(lua_State* l)
+    {
+        CPPLUA_OVERLOAD_PROBE(l);
+        typedef bool (*Match)(lua_State*);
+        static const Match matches[] = { &Overloads::match... };
+        static const lua_CFunction calls[] = { &Overloads::call... };
+        static constexpr int last = overload_last_top<Overloads...>();
+        static constexpr auto table = make_overload_table<Overloads...>();
+        //Every top above the bounded signatures shares the last bucket
+        const int top = std::min(lua_gettop(l), last + 1);
+        for(std::size_t i = 0; i < table.size[top]; ++i)
+        {
+            const std::size_t overload = table.index[top][i];
+            if(matches[overload](l))
+                return calls[overload](l);
+        }
+        return luaL_error(l, "No overload matches the arguments");
+    }
+};
+
+/**
+ * \param 	s State that carries lua_State
+ * \param 	name name of the function in the Lua environment
+ * \author 	Stud
+ * \brief 	Structure used to expose several C++ member functions under
+ *          the same name. Use OVERLOAD to give each member function.
+ */
+template<typename... Overloads>
+struct registerMemberOverloads : overloadSet<Overloads...>
+{
+    static void push(lua_State* l, const char* name)
+    {
+#ifdef CPPLUA_ENABLE_STATS
+        typedef typename std::tuple_element<0, std::tuple<Overloads...> >::type::class_type ClassName;
+        pushBoundOverloads(l, overloadSet<Overloads...>::call, (getClassName<ClassName>() + "." + name).c_str());
+#else
+        pushBoundOverloads(l, overloadSet<Overloads...>::call, name);
+#endif
+        //Link the function with the name in the method table
+        set_method(l, name);
+    }
+};
+
+/**
+ * \param 	s State that carries lua_State
+ * \param 	name name of the function in the Lua environment
+ * \author 	Stud
+ * \brief 	Structure used to expose several C++ static functions or C
+ *          functions under the same name. Use STATICOVERLOAD or
+ *          MODULEOVERLOAD to give each function.
+ */
+template<typename... Overloads>
+struct registerStaticOverloads : overloadSet<Overloads...>
+{
+    static void push(lua_State* l, const char* name)
+    {
+        pushBoundOverloads(l, overloadSet<Overloads...>::call, name);
+        //Link the function with the name
+        lua_setfield(l, -2, name);
+    }
+};
+
+/**
+ * \param 	l lua_State*
+ * \param 	field the address of the member
+ * \author 	Stud
+ * \brief 	Getter of the FieldDescriptor of a member of type Type.
+ */
+template <typename Type>
+void field_get(lua_State* l, void* field)
+{
+    push(l, *static_cast<Type*>(field));
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	field the address of the member
+ * \param 	index the index of the new value on the stack
+ * \author 	Stud
+ * \brief 	Setter of the FieldDescriptor of a member of type Type.
+ */
+template <typename Type>
+void field_set(lua_State* l, void* field, int index)
+{
+    *static_cast<Type*>(field) = read<Type>(l, index);
+}
+
+/**
+ * \return 	the descriptor of the member t
+ * \author 	Stud
+ */
+template<typename Type, typename ClassName, Type ClassName::* t>
+const FieldDescriptor& getFieldDescriptor()
+{
+    static const FieldDescriptor descriptor = {
+        &getClassInfo<ClassName>(),
+        getMemberOffset<Type, ClassName, t>(),
+        &field_get<Type>,
+        &field_set<Type>
+    };
+    return descriptor;
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	name name of the attribute in the Lua environment
+ * \author 	Stud
+ * \brief 	Expose a public attribute. Its descriptor is stored in the
+ *          attribute table, __index and __newindex use it to read and
+ *          write the member directly.
+ */
+template<typename Type, typename ClassName, Type ClassName::* t>
+void registerAttribute(lua_State* l, const char* name)
+{
+#ifdef CPPLUA_ENABLE_STATS
+    AttributeSlot* slot = static_cast<AttributeSlot*>(lua_newuserdata(l, sizeof(AttributeSlot)));
+    const std::string stats = getClassName<ClassName>() + "." + name;
+    slot->field = &getFieldDescriptor<Type, ClassName, t>();
+    slot->get = getCallStats(l, (stats + ":get").c_str());
+    slot->set = getCallStats(l, (stats + ":set").c_str());
+#else
+    lua_pushlightuserdata(l, const_cast<FieldDescriptor*>(&getFieldDescriptor<Type, ClassName, t>()));
+#endif
+    //Link the descriptor with the name in the attribute table
+    set_attribute(l, name);
+}
+
+/**
+ * \param 	Ret (*)(Args...)) the function pointer
+ * \author 	Stud
+ * \brief 	Avoids the user to write the templates
+ */
+template<typename Ret, typename... Args>
+auto deduceFunction(Ret (*)(Args...)) -> Ret(*)(Args...)
+{}
+
+/**
+ * \param 	ReturnType (ClassName::*)(Args...) the function pointer
+ * \author 	Marc
+ * \brief 	Avoids the user to write the templates
+ */
+template<typename ClassName, typename ReturnType, typename... Args>
+auto deduceMethod(ReturnType (ClassName::*)(Args...)) -> ReturnType (ClassName::*)(Args...)
+{}
+
+/**
+ * \author 	Stud
+ * \brief 	use MODULEFUNCTION(Func)::push(State, "name"); to register a module function
+ */
+#define MODULEFUNCTION(m) registerCFunction<decltype(deduceFunction(&m)), &m>
+
+/**
+ * \author 	Stud
+ * \brief 	use STATICFUNCTION(Class::Func)::push(State, "name"); to register a static function
+ */
+#define STATICMETHOD(m) registerStaticFunction<decltype(deduceFunction(&m)), &m>
+
+/**
+ * \author 	Marc
+ * \brief 	use METHOD(Class::Func)::push(State, "name"); to register a function
+ */
+#define METHOD(m) registerMemberFunction<decltype(deduceMethod(&m)), &m>
+
+/**
+ * \author 	Stud
+ * \brief 	use OVERLOAD(Ret (Class::*)(Args...), Class::Func) to select one
+ *          member function in METHODS(...)
+ */
+#define OVERLOAD(type, m) registerMemberFunction<type, &m>
+
+/**
+ * \author 	Stud
+ * \brief 	use STATICOVERLOAD(Ret (*)(Args...), Class::Func) to select one
+ *          static function in STATICMETHODS(...)
+ */
+#define STATICOVERLOAD(type, m) registerStaticFunction<type, &m>
+
+/**
+ * \author 	Stud
+ * \brief 	use MODULEOVERLOAD(Ret (*)(Args...), Func) to select one
+ *          module function in STATICMETHODS(...)
+ */
+#define MODULEOVERLOAD(type, m) registerCFunction<type, &m>
+
+/**
+ * \author 	Stud
+ * \brief 	use METHODS(OVERLOAD(...), OVERLOAD(...))::push(State, "name"); to
+ *          register several member functions under one name
+ */
+#define METHODS(...) registerMemberOverloads<__VA_ARGS__>
+
+/**
+ * \author 	Stud
+ * \brief 	use STATICMETHODS(STATICOVERLOAD(...), ...)::push(State, "name"); to
+ *          register several static or module functions under one name
+ */
+#define STATICMETHODS(...) registerStaticOverloads<__VA_ARGS__>
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	function used to register class constructor.
+ * 			SFINAE, case where constructor needs arguments.
  */
 template <typename ClassName, typename... Args>
 typename std::enable_if< (sizeof ...(Args) != 0) >::type
@@ -611,13 +1287,13 @@ generateConstructorFunction(lua_State * l)
     lua_pushcfunction(l, [](lua_State* l) {
         //Convert the variadic template into a tuple of arguments
         //initialized on the Lua stack
-        std::tuple<Args...> args = getArgs<Args...>(l, 2);
+        auto args = getArgs<Args...>(l, 2);
         //Unpack the tuple to instantiate an object
-        ClassName* elem = instantiate<ClassName>(l, args);
+        ClassName* elem = instantiate<ClassName>(l, std::move(args));
         //Hide the "warning: unused variable" at compile time.
         (void)elem;
-        //Push the metatable with the name of the class
-        luaL_getmetatable(l, getClassName<ClassName>().c_str());
+        //Push the metatable of the class
+        getClassMetatable<ClassName>(l);
         //Pops a table from the stack and set it as the metatable of the object
         lua_setmetatable(l, -2);
         return 1;
@@ -636,12 +1312,12 @@ generateConstructorFunction(lua_State * l)
 {
     lua_pushcfunction(l, [](lua_State* l) {
         //Placement new and instantiation of the object
-        void* data = lua_newuserdata(l, sizeof(ClassName));
+        void* data = newObject<ClassName>(l);
         ClassName* elem = new(data) ClassName();
         //Hide the "warning: unused variable" at compile time.
         (void)elem;
-        //Push the metatable with the name of the class
-        luaL_getmetatable(l, getClassName<ClassName>().c_str());
+        //Push the metatable of the class
+        getClassMetatable<ClassName>(l);
         //Pops a table from the stack and set it as the metatable of the object
         lua_setmetatable(l, -2);
         return 1;
@@ -662,7 +1338,7 @@ void registerConstructor(lua_State * l)
     //Set the metatable on the "constructor" table
     lua_setmetatable(l, -2);
     //Add the .prototype key with the metatable of the class as value
-    luaL_getmetatable(l, getClassName<ClassName>().c_str());
+    getClassMetatable<ClassName>(l);
     lua_setfield(l, -2, "prototype");
 }
 
@@ -676,13 +1352,25 @@ void registerDestructor(lua_State * l)
 {
     lua_pushstring(l, "__gc");
     lua_pushcfunction(l, [](lua_State* l) {
-        //Get the intance on the stack
-        ClassName * cl = l_checkClass<ClassName>(l, 1);
-        //Explicit call to the destructor as we used placementnew to instantiate
-        cl->~ClassName();
-        return 1;
+        //Get the header of the instance on the stack
+        ObjectHeader* header = toObjectHeader(l, 1);
+        //The header knows how the object is held (built in place with
+        //placement new, borrowed, smart pointer)
+        if(header == NULL)
+            return 0;
+        if(header->destroy != NULL)
+        {
+            header->destroy(header);
+            header->destroy = NULL;
+        }
+        CPPLUA_INSTANCE_DESTROYED(l, 1, header);
+        //__gc may be called again from Lua (getmetatable(o).__gc(o)), the
+        //userdata is no longer an object so it is neither used nor counted
+        header->magic = 0;
+        return 0;
     });
     lua_rawset(l, -3);
+    CPPLUA_INSTANCE_TRACK(getClassName<ClassName>(), getClassInfo<ClassName>());
 }
 
 /**
@@ -710,41 +1398,75 @@ void registerModule(lua_State* l, const char*  name)
     lua_setfield(l, -2, name);
 }
 
+/**
+ * \param 	l lua_State*
+ * \param 	field the descriptor of the attribute
+ * \return 	the address of the attribute in the instance at index 1
+ * \author 	Stud
+ * \brief 	The instance is converted to the class that declares the
+ *          attribute, then the offset of the member is added.
+ */
+inline void* field_address(lua_State* l, const FieldDescriptor* field)
+{
+    void* obj = checkudata(l, 1, *field->owner);
+    if(obj == NULL)
+        luaL_error(l, "The object does not have the requested member");
+    return static_cast<char*>(obj) + field->offset;
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	index index of a value of the attribute table
+ * \return 	the descriptor of the attribute
+ * \author 	Stud
+ */
+inline const FieldDescriptor* attribute_descriptor(lua_State* l, int index)
+{
+#ifdef CPPLUA_ENABLE_STATS
+    return static_cast<const AttributeSlot*>(lua_touserdata(l, index))->field;
+#else
+    return static_cast<const FieldDescriptor*>(lua_touserdata(l, index));
+#endif
+}
+
 /**
  * \param 	l lua_State*
  * \author 	Stud
  * \brief 	function called when the application tries to access to an
  *          element (function or attribute) in the userdata.
- *          If it is a function, we must return a function, we return a
- *          lambda that return the function so that the application can
- *          call it.
+ *          The upvalues are the flattened method table, the attribute
+ *          table and the metatable of the class. A method is found with a
+ *          single raw get whatever the depth of the inheritance, and the
+ *          function is returned directly so that the application can call it.
  */
 inline int indexFunction(lua_State* l)
 {
-    lua_insert(l, 1);
-    do
+    //Look for a method (inherited ones are already in the table)
+    lua_pushvalue(l, 2);
+    lua_rawget(l, lua_upvalueindex(1));
+    if(!lua_isnil(l, -1))
+        return 1;
+    lua_pop(l, 1);
+    //Look for an attribute and read the member. __index -> get()
+    lua_pushvalue(l, 2);
+    lua_rawget(l, lua_upvalueindex(2));
+    if(!lua_isnil(l, -1))
     {
-        //If it's not the first iteration, nil is on the stack
-        if(lua_isnil(l, -1))
-            lua_remove(l, -1);
-        //Get the userdata's or the table's metatable
-        if(!lua_getmetatable(l, -1))
-        {
-            //If it does not have a metatable, it means the object does not have that member
-            fprintf(stderr, "The object does not have the requested member\n");
-            exit (EXIT_FAILURE);
-        }
-        //Move the table to the valid index for gettable
-        lua_pushvalue(l, 1);
-        lua_rawget(l, -2);
-    } while(lua_isnil(l, -1));
-    //Set all the value on the right position for lua_call (function userdata)
+        const FieldDescriptor* field = attribute_descriptor(l, -1);
+        CPPLUA_ATTRIBUTE_PROBE(l, -1, get);
+        field->get(l, field_address(l, field));
+        return 1;
+    }
+    lua_pop(l, 1);
+    //Look for the fields of the metatable (_prototype, ...)
     lua_pushvalue(l, 2);
-    //Call the lambda that will return the attribute or the method. __index -> get()
-    lua_call(l, 1, 1);
-    //Clean the stack
-    while(lua_gettop(l) > 1)
-        lua_remove(l, 1);
+    lua_rawget(l, lua_upvalueindex(3));
+    if(lua_isnil(l, -1))
+    {
+        //If it is not there either, the object does not have that member
+        fprintf(stderr, "The object does not have the requested member\n");
+        exit (EXIT_FAILURE);
+    }
     return 1;
 }
 
@@ -753,61 +1475,124 @@ inline int indexFunction(lua_State* l)
  * \author 	Stud
  * \brief 	function called when the application tries to update the value
  *          of a userdata's element. The value will only be updated if the
- *          element leads to an attribute (if the function is a setter).
+ *          element leads to an attribute. The upvalue is the flattened
+ *          attribute table of the class.
  */
 inline int newIndexFunction(lua_State* l)
 {
-    lua_insert(l, 1);
-    lua_insert(l, 1);
-    do
-    {
-        //If it's not the first iteration, nil is on the stack
-        if(lua_isnil(l, -1))
-            lua_remove(l, -1);
-        //Get the userdata's or the table's metatable
-        if(!lua_getmetatable(l, -1))
-        {
-            //If it does not have a metatable, it means the object does not have that member
-            fprintf(stderr, "The object does not have the requested member\n");
-            exit (EXIT_FAILURE);
-        }
-        //Move the table to the valid index for gettable
-        lua_pushvalue(l, 1);
-        lua_rawget(l, -2);
-    } while(lua_isnil(l, -1));
-    //Set all the value on the right position for lua_call (function userdata)
-    lua_pushvalue(l, 3);
     lua_pushvalue(l, 2);
-    lua_pushvalue(l, 1);
-    //Call the lambda that will return the attribute or the method. __index -> get()
-    lua_call(l, 3, 0);
-    //Clean the stack
-    lua_settop(l, 0);
-    return 1;
+    lua_rawget(l, lua_upvalueindex(1));
+    if(lua_isnil(l, -1))
+    {
+        //If it is not there, the object does not have that member
+        fprintf(stderr, "The object does not have the requested member\n");
+        exit (EXIT_FAILURE);
+    }
+    //Write the member with the new value. __newindex -> set()
+    const FieldDescriptor* field = attribute_descriptor(l, -1);
+    CPPLUA_ATTRIBUTE_PROBE(l, -1, set);
+    field->set(l, field_address(l, field), 3);
+    return 0;
 }
 
 /**
  * \param 	l lua_State*
+ * \param 	methods the number of methods, used to presize the method table
  * \author 	Stud
  * \brief 	function that create the metatable when we register classes.
  *          It also adds the metamethods __index, __newindex and _prototype.
  */
 template <typename ClassName>
-void create_metatable(lua_State* l)
+void create_metatable(lua_State* l, int methods = 0)
 {
-    //Create a metatable for this class
-    luaL_newmetatable(l, getClassName<ClassName>().c_str());
+    //Create a metatable for this class. It is found with the key of the
+    //class, the name is only used to find the parents of other classes.
+    lua_createtable(l, 0, 7);
+    lua_pushvalue(l, -1);
+    lua_rawsetp(l, LUA_REGISTRYINDEX, getClassKey<ClassName>());
+    lua_pushvalue(l, -1);
+    lua_setfield(l, LUA_REGISTRYINDEX, getClassName<ClassName>().c_str());
+
+    //Add the flattened tables that hold the methods and the attributes
+    lua_createtable(l, 0, methods);
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -3, "_methods");
+    lua_newtable(l);
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -4, "_attributes");
+
+    //Add the newindex, it only needs the attributes
+    lua_pushvalue(l, -1);
+    lua_pushcclosure(l, newIndexFunction, 1);
+    lua_setfield(l, -4, "__newindex");
 
-    //Add the index
-    lua_pushcfunction(l, indexFunction);
+    //Add the index with the methods, the attributes and the metatable
+    lua_pushvalue(l, -3);
+    lua_pushcclosure(l, indexFunction, 3);
     lua_setfield(l, -2, "__index");
 
     lua_pushvalue(l, -1);
     lua_setfield(l, -2, "_prototype");
 
-    //Add the newindex
-    lua_pushcfunction(l, newIndexFunction);
-    lua_setfield(l, -2, "__newindex");
+    //Add the ClassInfo so that the children can find their parent
+    lua_pushlightuserdata(l, &getClassInfo<ClassName>());
+    lua_setfield(l, -2, "_classinfo");
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	field name of the table in the metatables ("_methods" or "_attributes")
+ * \author 	Stud
+ * \brief 	Copies the elements of the parent's table that the class does not
+ *          define in the table of the class. The class' metatable and the
+ *          parent's metatable must be on top of the stack.
+ */
+inline void flatten_table(lua_State* l, const char* field)
+{
+    //Get the parent's table then the class' table
+    lua_pushstring(l, field);
+    lua_rawget(l, -2);
+    lua_pushstring(l, field);
+    lua_rawget(l, -4);
+    lua_pushnil(l);
+    while(lua_next(l, -3) != 0)
+    {
+        //Keep the key for the next iteration
+        lua_pushvalue(l, -2);
+        lua_rawget(l, -4);
+        if(lua_isnil(l, -1))
+        {
+            lua_pop(l, 1);
+            lua_pushvalue(l, -2);
+            lua_insert(l, -2);
+            lua_rawset(l, -4);
+        }
+        else
+            lua_pop(l, 2);
+    }
+    lua_pop(l, 2);
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	offset the offset between a pointer on the class and a pointer
+ *          on the parent.
+ * \author 	Stud
+ * \brief 	Adds the parent and its ancestors to the ClassInfo of the class
+ *          and copies the parent's methods and attributes. The class'
+ *          metatable and the parent's metatable must be on top of the stack.
+ */
+inline void inherit_values(lua_State* l, std::ptrdiff_t offset)
+{
+    lua_getfield(l, -2, "_classinfo");
+    lua_getfield(l, -2, "_classinfo");
+    ClassInfo* info = static_cast<ClassInfo*>(lua_touserdata(l, -2));
+    ClassInfo* parent = static_cast<ClassInfo*>(lua_touserdata(l, -1));
+    lua_pop(l, 2);
+    info->add_parent(*parent, offset);
+
+    flatten_table(l, "_methods");
+    flatten_table(l, "_attributes");
 }
 
 /**
@@ -815,10 +1600,9 @@ void create_metatable(lua_State* l)
  * \param 	inhClassName std::string The name of the parent's class in the module.
  *          If the parent is in another module, use "moduleName.className"
  * \author 	Stud
- * \brief 	function that set a parent's metatable as the metatable of the
- *          class that inherits it.
+ * \brief 	Push the parent's metatable, nil if the parent is not registered.
  */
-inline void load_inherited_values(lua_State* l, std::string inhClassName)
+inline void load_parent_metatable(lua_State* l, std::string inhClassName)
 {
     //Check if the parent class is in another module, if so load it.
     std::size_t found = inhClassName.find(".");
@@ -829,19 +1613,62 @@ inline void load_inherited_values(lua_State* l, std::string inhClassName)
         luaL_dostring(l, ("require(\"" + module + "\")").c_str());
     }
     luaL_getmetatable(l, inhClassName.c_str());
+    if(lua_isnil(l, -1))
+    {
+        //The parent may be registered lazily
+        lua_pop(l, 1);
+        lua_pushstring(l, inhClassName.c_str());
+        buildLazyClass(l);
+        luaL_getmetatable(l, inhClassName.c_str());
+    }
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	inhClassName std::string The name of the parent's class in the module.
+ *          If the parent is in another module, use "moduleName.className"
+ * \param 	offset the offset between a pointer on the class and a pointer
+ *          on the parent (getParentOffset).
+ * \author 	Stud
+ * \brief 	function that set a parent's metatable as the metatable of the
+ *          class that inherits it.
+ */
+inline void load_inherited_values(lua_State* l, std::string inhClassName, std::ptrdiff_t offset)
+{
+    load_parent_metatable(l, inhClassName);
+    if(lua_istable(l, -1))
+        inherit_values(l, offset);
     lua_setmetatable(l, -2);
 }
 
+/**
+ * \param 	l lua_State*
+ * \param 	inhClassName the name of the parent class. If the parent is in another module,
+ *          use "moduleName.className"
+ * \author 	Stud
+ * \brief 	function used to add a C++ base to a class, with the right pointer
+ *          adjustment for multiple inheritance. It needs to be called inside
+ *          the function that registers the member functions of the class.
+ */
+template <typename ClassName, typename Parent>
+void registerParent(lua_State* l, std::string inhClassName)
+{
+    load_parent_metatable(l, inhClassName);
+    if(lua_istable(l, -1))
+        inherit_values(l, getParentOffset<ClassName, Parent>());
+    lua_pop(l, 1);
+}
+
 /**
  * \param 	l lua_State*
  * \param 	name the name of the class in the module.
  * \author 	Stud
  * \brief 	function used to ends a class registration.
  */
-inline void set_field(lua_State* l, std::string name)
+inline void set_field(lua_State* l, const char* name)
 {
     //Add the constructor table to the module
-    lua_setfield(l, -3, name.c_str());
+    lua_setfield(l, -3, name);
     //Clean the stack
     lua_remove(l, -1);
 }
@@ -856,7 +1683,7 @@ inline void set_field(lua_State* l, std::string name)
  *          inside the function that is passed as a callback in registerModule.
  */
 template <typename ClassName, typename... Args>
-void registerClass(lua_State* l, int (*f)(lua_State*), std::string  name)
+void registerClass(lua_State* l, int (*f)(lua_State*), const char* name)
 {
     //Create the metatable and init the values of the metamethods
     create_metatable<ClassName>(l);
@@ -899,25 +1726,70 @@ void registerClass(lua_State* l, int (*f)(lua_State*), int (*g)(lua_State*), con
     set_field(l, name);
 }
 
+/**
+ * \param 	l lua_State*
+ * \param 	methods the registration table of the methods, see registerMethods
+ * \param 	name the name of the class in the module.
+ * \author 	Stud
+ * \brief 	function used to register a class from a registration table
+ *          instead of a function: the method table is created with the
+ *          right size and filled in one pass.
+ */
+template <typename ClassName, typename... Args, std::size_t N>
+void registerClass(lua_State* l, const luaL_Reg (&methods)[N], const char* name)
+{
+    create_metatable<ClassName>(l, N);
+    registerMethods(l, methods);
+    registerDestructor<ClassName>(l);
+    registerConstructor<ClassName, Args...>(l);
+
+    set_field(l, name);
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	methods the registration table of the methods, see registerMethods
+ * \param 	statics the registration table of the static functions
+ * \param 	name the name of the class in the module.
+ * \author 	Stud
+ * \brief 	Same as above with static functions.
+ */
+template <typename ClassName, typename... Args, std::size_t N, std::size_t M>
+void registerClass(lua_State* l, const luaL_Reg (&methods)[N], const luaL_Reg (&statics)[M], const char* name)
+{
+    create_metatable<ClassName>(l, N);
+    registerMethods(l, methods);
+    registerDestructor<ClassName>(l);
+    registerConstructor<ClassName, Args...>(l);
+    registerFunctions(l, statics);
+
+    set_field(l, name);
+}
+
 /**
  * \param 	l lua_State*
  * \param 	f  int(*)(lua_State*) the function that calls the macros used to register
  *          the non static class elements.
+ * \param 	g  int(*)(lua_State*) the function that calls the macros used to register
+ *          the static class elements, or NULL.
  * \param 	name the name of the class in the module.
  * \param 	inhClassName the name of the parent class. If the parent is in another module,
  *          use "moduleName.className"
+ * \param 	offset the offset between a pointer on the class and a pointer
+ *          on the parent.
  * \author 	Stud
- * \brief 	function used to register a class that inherit from another class within a module. It needs to be called
- *          inside the function that is passed as a callback in registerModule.
+ * \brief 	The registration shared by registerClassInherit and the classes
+ *          built lazily, which only know the offset.
  */
 template <typename ClassName, typename... Args>
-void registerClassInherit(lua_State* l, int (*f)(lua_State*), const char*  name, std::string inhClassName)
+void registerInheritedClass(lua_State* l, int (*f)(lua_State*), int (*g)(lua_State*), const char* name,
+                            std::string inhClassName, std::ptrdiff_t offset)
 {
     //Create the metatable and init the values of the metamethods
     create_metatable<ClassName>(l);
 
     //Call the parent module if needed and take the parent metamethod
-    load_inherited_values(l, inhClassName);
+    load_inherited_values(l, inhClassName, offset);
 
     //Register all the member function that we want to expose to Lua
     (*f)(l);
@@ -925,10 +1797,32 @@ void registerClassInherit(lua_State* l, int (*f)(lua_State*), const char*  name,
     registerDestructor<ClassName>(l);
     //Register the destructor
     registerConstructor<ClassName, Args...>(l);
+    //Register all the static member function that we want to expose to Lua
+    if(g != NULL)
+        (*g)(l);
 
     set_field(l, name);
 }
 
+/**
+ * \param 	l lua_State*
+ * \param 	f  int(*)(lua_State*) the function that calls the macros used to register
+ *          the non static class elements.
+ * \param 	name the name of the class in the module.
+ * \param 	inhClassName the name of the parent class. If the parent is in another module,
+ *          use "moduleName.className"
+ * \author 	Stud
+ * \brief 	function used to register a class that inherit from another class within a module. It needs to be called
+ *          inside the function that is passed as a callback in registerModule.
+ *          Parent is the C++ base registered as inhClassName, the pointers
+ *          are adjusted when it is not the first base.
+ */
+template <typename ClassName, typename Parent, typename... Args>
+void registerClassInherit(lua_State* l, int (*f)(lua_State*), const char*  name, std::string inhClassName)
+{
+    registerInheritedClass<ClassName, Args...>(l, f, NULL, name, inhClassName, getParentOffset<ClassName, Parent>());
+}
+
 /**
  * \param 	l lua_State*
  * \param 	f  int(*)(lua_State*) the function that calls the macros used to register
@@ -940,26 +1834,205 @@ void registerClassInherit(lua_State* l, int (*f)(lua_State*), const char*  name,
  * \author 	Stud
  * \brief 	function used to register a class that inherit from another class within a module. It needs to be called
  *          inside the function that is passed as a callback in registerModule.
+ *          Parent is the C++ base registered as inhClassName.
  */
-template <typename ClassName, typename... Args>
+template <typename ClassName, typename Parent, typename... Args>
 void registerClassInherit(lua_State* l, int (*f)(lua_State*), int (*g)(lua_State*), const char*  name, std::string inhClassName)
 {
-    //Create the metatable and init the values of the metamethods
-    create_metatable<ClassName>(l);
+    registerInheritedClass<ClassName, Args...>(l, f, g, name, inhClassName, getParentOffset<ClassName, Parent>());
+}
 
-    //Call the parent's module and take the parent's metamethod
-    load_inherited_values(l, inhClassName);
+/**
+ * \author 	Stud
+ * \brief 	The loaders of a class registered lazily
+ */
+struct LazyClassLoaders
+{
+    int (*f)(lua_State*);
+    int (*g)(lua_State*);
+    /** The offset of the parent, for an inherited class */
+    std::ptrdiff_t offset;
+};
 
-    //Register all the member function that we want to expose to Lua
-    (*f)(l);
-    //Register the destructor
-    registerDestructor<ClassName>(l);
-    //Register the destructor
-    registerConstructor<ClassName, Args...>(l);
-    //Register all the static member function that we want to expose to Lua
-    (*g)(l);
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Builds a class registered lazily: the class is registered in a
+ *          scratch module then its constructor table is copied in the proxy
+ *          table that the module holds. The upvalues are the loaders, the
+ *          proxy, the name of the class and the name of its parent (or nil).
+ */
+template <typename ClassName, typename... Args>
+int lazyBuild(lua_State* l)
+{
+    const LazyClassLoaders* loaders = static_cast<const LazyClassLoaders*>(lua_touserdata(l, lua_upvalueindex(1)));
+    const char* name = lua_tostring(l, lua_upvalueindex(3));
+
+    //Remove the pending entries first, the registration looks the class up
+    lua_rawgetp(l, LUA_REGISTRYINDEX, getLazyClassesKey());
+    lua_pushnil(l);
+    lua_rawsetp(l, -2, getClassKey<ClassName>());
+    lua_pushnil(l);
+    lua_setfield(l, -2, getClassName<ClassName>().c_str());
+    lua_pop(l, 1);
+
+    //The scratch module
+    lua_newtable(l);
+    if(lua_isnil(l, lua_upvalueindex(4)))
+    {
+        if(loaders->g != NULL)
+            registerClass<ClassName, Args...>(l, loaders->f, loaders->g, name);
+        else
+            registerClass<ClassName, Args...>(l, loaders->f, name);
+    }
+    else
+    {
+        std::string inhClassName = lua_tostring(l, lua_upvalueindex(4));
+        registerInheritedClass<ClassName, Args...>(l, loaders->f, loaders->g, name, inhClassName, loaders->offset);
+    }
 
-    set_field(l, name);
+    //Copy the constructor table (prototype and static functions) in the proxy
+    lua_getfield(l, -1, name);
+    lua_pushvalue(l, lua_upvalueindex(2));
+    lua_pushnil(l);
+    while(lua_next(l, -3) != 0)
+    {
+        lua_pushvalue(l, -2);
+        lua_insert(l, -2);
+        lua_rawset(l, -4);
+    }
+    //The proxy takes the metatable that holds the constructor
+    lua_getmetatable(l, -2);
+    lua_setmetatable(l, -2);
+    lua_pop(l, 3);
+    return 0;
+}
+
+/**
+ * \brief 	__call of a proxy not built yet: builds the class then calls
+ *          its constructor.
+ */
+inline int lazyCall(lua_State* l)
+{
+    lua_pushvalue(l, lua_upvalueindex(1));
+    lua_call(l, 0, 0);
+    lua_call(l, lua_gettop(l) - 1, 1);
+    return 1;
+}
+
+/**
+ * \brief 	__index of a proxy not built yet: builds the class then reads
+ *          the field of its constructor table.
+ */
+inline int lazyIndex(lua_State* l)
+{
+    lua_pushvalue(l, lua_upvalueindex(1));
+    lua_call(l, 0, 0);
+    lua_gettable(l, 1);
+    return 1;
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	f the function that registers the non static class elements
+ * \param 	g the function that registers the static class elements, or NULL
+ * \param 	name the name of the class in the module
+ * \param 	inhClassName the name of the parent class, or NULL
+ * \param 	offset the offset of the parent class
+ * \author 	Stud
+ * \brief 	Adds the proxy of a class to the module on top of the stack and
+ *          records how to build the class.
+ */
+template <typename ClassName, typename... Args>
+void pushLazyClass(lua_State* l, int (*f)(lua_State*), int (*g)(lua_State*), const char* name,
+                   const char* inhClassName, std::ptrdiff_t offset)
+{
+    //The proxy, it takes the place of the constructor table in the module
+    lua_newtable(l);
+
+    //The builder
+    LazyClassLoaders* loaders = static_cast<LazyClassLoaders*>(lua_newuserdata(l, sizeof(LazyClassLoaders)));
+    loaders->f = f;
+    loaders->g = g;
+    loaders->offset = offset;
+    lua_pushvalue(l, -2);
+    lua_pushstring(l, name);
+    if(inhClassName != NULL)
+        lua_pushstring(l, inhClassName);
+    else
+        lua_pushnil(l);
+    lua_pushcclosure(l, lazyBuild<ClassName, Args...>, 4);
+
+    //Record the builder with the key and the name of the class
+    lua_rawgetp(l, LUA_REGISTRYINDEX, getLazyClassesKey());
+    if(lua_isnil(l, -1))
+    {
+        lua_pop(l, 1);
+        lua_newtable(l);
+        lua_pushvalue(l, -1);
+        lua_rawsetp(l, LUA_REGISTRYINDEX, getLazyClassesKey());
+    }
+    lua_pushvalue(l, -2);
+    lua_rawsetp(l, -2, getClassKey<ClassName>());
+    lua_pushvalue(l, -2);
+    lua_setfield(l, -2, getClassName<ClassName>().c_str());
+    lua_pop(l, 1);
+
+    //The metatable of the proxy builds the class on first use
+    lua_createtable(l, 0, 2);
+    lua_pushvalue(l, -2);
+    lua_pushcclosure(l, lazyCall, 1);
+    lua_setfield(l, -2, "__call");
+    lua_insert(l, -2);
+    lua_pushcclosure(l, lazyIndex, 1);
+    lua_setfield(l, -2, "__index");
+    lua_setmetatable(l, -2);
+
+    lua_setfield(l, -2, name);
+}
+
+/**
+ * \param 	l lua_State*
+ * \param 	f  int(*)(lua_State*) the function that calls the macros used to register
+ *          the non static class elements.
+ * \param 	name the name of the class in the module.
+ * \author 	Stud
+ * \brief 	Same as registerClass, but the metatable and the method table
+ *          are only created the first time the class is constructed,
+ *          referenced from Lua, pushed from C++ or inherited from.
+ */
+template <typename ClassName, typename... Args>
+void registerLazyClass(lua_State* l, int (*f)(lua_State*), const char* name)
+{
+    pushLazyClass<ClassName, Args...>(l, f, NULL, name, NULL, 0);
+}
+
+/**
+ * \brief 	Same as registerClass with static elements, built lazily.
+ */
+template <typename ClassName, typename... Args>
+void registerLazyClass(lua_State* l, int (*f)(lua_State*), int (*g)(lua_State*), const char* name)
+{
+    pushLazyClass<ClassName, Args...>(l, f, g, name, NULL, 0);
+}
+
+/**
+ * \brief 	Same as registerClassInherit, built lazily. The parent is built
+ *          when the class is.
+ */
+template <typename ClassName, typename Parent, typename... Args>
+void registerLazyClassInherit(lua_State* l, int (*f)(lua_State*), const char* name, const char* inhClassName)
+{
+    pushLazyClass<ClassName, Args...>(l, f, NULL, name, inhClassName, getParentOffset<ClassName, Parent>());
+}
+
+/**
+ * \brief 	Same as registerClassInherit with static elements, built lazily.
+ */
+template <typename ClassName, typename Parent, typename... Args>
+void registerLazyClassInherit(lua_State* l, int (*f)(lua_State*), int (*g)(lua_State*), const char* name, const char* inhClassName)
+{
+    pushLazyClass<ClassName, Args...>(l, f, g, name, inhClassName, getParentOffset<ClassName, Parent>());
 }
 
 #endif
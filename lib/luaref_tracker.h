@@ -10,35 +10,142 @@
 
 /** This class is used to be sure that a registered elements in lua is
  *  deleted.
- * 
- *  For example when a lua function is given as a callback to a C++ 
- *  function, it is necessary to keep a reference to the function as 
- *  it'll not stay on the stack forever. 
- *  It is then necesseray to be able to delete it to avoid memory leaks. */
+ *
+ *  For example when a lua function is given as a callback to a C++
+ *  function, it is necessary to keep a reference to the function as
+ *  it'll not stay on the stack forever.
+ *  It is then necesseray to be able to delete it to avoid memory leaks.
+ *
+ *  The same Lua function given several times shares one record: a
+ *  userdata owned by Lua that holds the count of the trackers. The
+ *  record is found in a table of the registry indexed by the functions,
+ *  and the function is found in the registry with the record as a light
+ *  userdata key. Copying a tracker only increments the count, there is no
+ *  heap allocation.
+ *
+ *  A nil or missing value (an optional callback not given) has no
+ *  record, the tracker pushes nil and calling it raises the usual Lua
+ *  error. */
 
 class LuarefTracker
 {
 public:
     LuarefTracker(lua_State* l, int index) :
-        l_(l)
+        l_(l),
+        record_(NULL)
     {
-
+        if(lua_isnoneornil(l, index))
+            return;
+        index = lua_absindex(l, index);
+        //The table of the records, indexed by the functions
+        lua_rawgetp(l, LUA_REGISTRYINDEX, &records_key());
+        if(lua_isnil(l, -1))
+        {
+            lua_pop(l, 1);
+            lua_newtable(l);
+            lua_pushvalue(l, -1);
+            lua_rawsetp(l, LUA_REGISTRYINDEX, &records_key());
+        }
         lua_pushvalue(l, index);
-        ref_ = luaL_ref(l, LUA_REGISTRYINDEX);
+        lua_rawget(l, -2);
+        if(lua_isnil(l, -1))
+        {
+            //First time the function is tracked
+            lua_pop(l, 1);
+            Record* record = static_cast<Record*>(lua_newuserdata(l, sizeof(Record)));
+            record->count = 0;
+            lua_pushvalue(l, index);
+            lua_pushvalue(l, -2);
+            lua_rawset(l, -4);
+            lua_pushvalue(l, index);
+            lua_rawsetp(l, LUA_REGISTRYINDEX, record);
+        }
+        record_ = static_cast<Record*>(lua_touserdata(l, -1));
+        ++record_->count;
+        lua_pop(l, 2);
+    }
+
+    LuarefTracker(const LuarefTracker& t) :
+        l_(t.l_),
+        record_(t.record_)
+    {
+        if(record_ != NULL)
+            ++record_->count;
+    }
+
+    LuarefTracker& operator=(const LuarefTracker& t)
+    {
+        if(t.record_ != NULL)
+            ++t.record_->count;
+        release();
+        l_ = t.l_;
+        record_ = t.record_;
+        return *this;
     }
 
     ~LuarefTracker()
     {
-        luaL_unref(l_, LUA_REGISTRYINDEX, ref_);
+        release();
+    }
+
+    /**
+     * \author 	Stud
+     * \brief 	Push the tracked function on the stack of the state
+     */
+    void push() const
+    {
+        push(l_);
+    }
+
+    /**
+     * \param 	l a thread of the state of the tracker
+     * \author 	Stud
+     * \brief 	Push the tracked function on the stack of the thread
+     */
+    void push(lua_State* l) const
+    {
+        if(record_ != NULL)
+            lua_rawgetp(l, LUA_REGISTRYINDEX, record_);
+        else
+            lua_pushnil(l);
     }
 
-    int get_ref()
+    lua_State* get_state() const
     {
-        return ref_;
+        return l_;
     }
 
 private:
-    int ref_;
+    struct Record
+    {
+        int count;
+    };
+
+    static const char& records_key()
+    {
+        static const char key = 0;
+        return key;
+    }
+
+    /**
+     * \author 	Stud
+     * \brief 	Removes the function from the registry when the last
+     *          tracker is destroyed, Lua collects the record.
+     */
+    void release()
+    {
+        if(record_ == NULL || --record_->count > 0)
+            return;
+        lua_rawgetp(l_, LUA_REGISTRYINDEX, &records_key());
+        push();
+        lua_pushnil(l_);
+        lua_rawset(l_, -3);
+        lua_pop(l_, 1);
+        lua_pushnil(l_);
+        lua_rawsetp(l_, LUA_REGISTRYINDEX, record_);
+    }
+
     lua_State* l_;
+    Record* record_;
 };
 #endif
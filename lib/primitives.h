@@ -10,6 +10,11 @@
 
 #include <string>
 #include <algorithm>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#include <typeinfo>
+#include <type_traits>
 
 extern "C" {
 #include "lua5.2/lua.h"
@@ -18,6 +23,7 @@ extern "C" {
 }
 
 #include "trait.h"
+#include "class_info.h"
  	
  /**
   * \brief 	Default type is not a primitive
@@ -52,7 +58,7 @@ struct is_primitive<bool> {
   */
 template <>
 struct is_primitive<lua_Number> {
-    static constexpr bool result = true;
+    static constexpr bool value = true;
 };
  /**
   * \brief 	std::string type is a primitive
@@ -61,6 +67,22 @@ template <>
 struct is_primitive<std::string> {
     static constexpr bool value = true;
 };
+ /**
+  * \brief 	C string type is a primitive
+  */
+template <>
+struct is_primitive<const char*> {
+    static constexpr bool value = true;
+};
+#if __cplusplus >= 201703L
+ /**
+  * \brief 	std::string_view type is a primitive
+  */
+template <>
+struct is_primitive<std::string_view> {
+    static constexpr bool value = true;
+};
+#endif
 
 /**
  * 	\param 		std::string&& the std::string that'll be cleaned.
@@ -83,9 +105,81 @@ inline std::string&& stripString(std::string&& s)
  * 	\brief 		converts the class name to an std::string
  * */
 template <typename T>
-std::string getClassName()
+const std::string& getClassName()
+{
+    static const std::string name = stripString(typeid(T).name());
+    return name;
+}
+
+/**
+ * 	\return 	the key of the class' metatable in the registry
+ * 	\author 	Stud
+ * 	\brief 		The address of the ClassInfo is unique for each type, it
+ * 				is used as a light userdata key so that finding the
+ * 				metatable is a pointer comparison and allocates nothing.
+ * */
+template <typename T>
+const void* getClassKey()
+{
+    return &getClassInfo<T>();
+}
+
+/**
+ * 	\return 	the key of the table of the classes registered lazily and
+ * 				not built yet. The table gives the function that builds a
+ * 				class from its key and from its name.
+ * 	\author 	Stud
+ * */
+inline const void* getLazyClassesKey()
+{
+    static const char key = 0;
+    return &key;
+}
+
+/**
+ * 	\param 		l the lua_state*
+ * 	\param 		key the key of the class (light userdata) or its name (string)
+ * 				on top of the stack, it is popped
+ * 	\return 	true if the class was registered lazily and is now built
+ * 	\author 	Stud
+ * */
+inline bool buildLazyClass(lua_State* l)
+{
+    lua_rawgetp(l, LUA_REGISTRYINDEX, getLazyClassesKey());
+    if(lua_isnil(l, -1))
+    {
+        lua_pop(l, 2);
+        return false;
+    }
+    lua_insert(l, -2);
+    lua_rawget(l, -2);
+    lua_remove(l, -2);
+    if(!lua_isfunction(l, -1))
+    {
+        lua_pop(l, 1);
+        return false;
+    }
+    lua_call(l, 0, 0);
+    return true;
+}
+
+/**
+ * 	\param 		l the lua_state*
+ * 	\author 	Stud
+ * 	\brief 		Push the metatable of the class T on the stack (nil if the
+ * 				class is not registered). A class registered lazily is
+ * 				built the first time its metatable is needed.
+ * */
+template <typename T>
+void getClassMetatable(lua_State* l)
 {
-    return stripString(typeid(T).name());
+    lua_rawgetp(l, LUA_REGISTRYINDEX, getClassKey<T>());
+    if(!lua_isnil(l, -1))
+        return;
+    lua_pop(l, 1);
+    lua_pushlightuserdata(l, const_cast<void*>(getClassKey<T>()));
+    buildLazyClass(l);
+    lua_rawgetp(l, LUA_REGISTRYINDEX, getClassKey<T>());
 }
 
 inline void sdump (lua_State* l_)
@@ -122,55 +216,37 @@ inline void sdump (lua_State* l_)
 /**
  * 	\param 		l the lua_state*
  * 	\param 		ud the index on the Lua stack where the instance is.
- * 	\return 	an instance of ClassName
+ * 	\return 	the header of the object, NULL if the value is not a
+ * 				userdata instantiated by the binding.
  * 	\author 	Stud
- * 	\brief 		Check whether the userdata on the stack is of type
- * 				ClassName and return it. Recursively check for
- *              possible parents metatables.
  * */
-inline LUALIB_API void *checkudata (lua_State *L, int ud) {
-    //Check for parents
-    if (lua_getmetatable(L, -1))
-    {
-        lua_getmetatable(L, -1);
-        if (!lua_rawequal(L, -1, -2))
-        {
-            checkudata(L, ud);
-        }
-        lua_pop(L, 1);
-    }
-    else
+inline ObjectHeader* toObjectHeader(lua_State *L, int ud)
+{
+    if(lua_type(L, ud) != LUA_TUSERDATA || lua_rawlen(L, ud) < sizeof(ObjectHeader))
+        return NULL;
+    ObjectHeader* header = static_cast<ObjectHeader*>(lua_touserdata(L, ud));
+    if(header->magic != ObjectHeader::MAGIC)
         return NULL;
+    return header;
 }
 
 /**
  * 	\param 		l the lua_state*
  * 	\param 		ud the index on the Lua stack where the instance is.
- * 	\param 		tname the name of the mematable in the registry
- * 	\return 	an instance of ClassName
+ * 	\param 		info the ClassInfo of the expected class
+ * 	\return 	the object converted to the expected class, NULL if it is
+ * 				not an instance of the class or of one of its children.
  * 	\author 	Stud
- * 	\brief 		Check whether the userdata on the stack is of type
- * 				ClassName and return it.
+ * 	\brief 		Check whether the userdata on the stack is of the expected
+ * 				class with the type tag of its header, then apply the offset
+ * 				of the parent if needed.
  * */
-inline LUALIB_API void *checkudata (lua_State *L, int ud, const char *tname) {
-    //fprintf(stderr, "try : ");
-    //sdump(L);
-    void *p = lua_touserdata(L, ud);
-    if (p != NULL)
-    {  /* value is a userdata? */
-        if (lua_getmetatable(L, ud))
-        {  /* does it have a metatable? */
-            luaL_getmetatable(L, tname);  /* get correct metatable */
-            if (!lua_rawequal(L, -1, -2))  /* not the same? */
-            {
-                checkudata(L, ud);
-            }
-            lua_pop(L, 2);  /* remove both metatables */
-            return p;
-        }
-    }
-    //fprintf(stderr, "fail\n");
-    return NULL;  /* value is not a userdata with a metatable */
+inline void *checkudata (lua_State *L, int ud, const ClassInfo& info) {
+    ObjectHeader* header = toObjectHeader(L, ud);
+    std::ptrdiff_t offset;
+    if(header == NULL || header->object == NULL || !header->info->cast_offset(info, offset))
+        return NULL;
+    return static_cast<char*>(header->object) + offset;
 }
 
 /**
@@ -184,10 +260,106 @@ inline LUALIB_API void *checkudata (lua_State *L, int ud, const char *tname) {
 template <typename ClassName>
 ClassName * l_checkClass(lua_State *l, int n)
 {
-    return static_cast<ClassName*>(checkudata(l, n, getClassName<ClassName>().c_str() ));
+    typedef typename std::remove_cv<ClassName>::type Type;
+    return static_cast<ClassName*>(checkudata(l, n, getClassInfo<Type>()));
 }
 
+/**
+ * 	\param 		l the lua_state*
+ * 	\param 		n the index on the Lua stack where the instance is.
+ * 	\return 	an instance of ClassName
+ * 	\author 	Stud
+ * 	\brief 		Same as l_checkClass but raises a Lua error if the value
+ * 				is not an instance of ClassName.
+ * */
+template <typename ClassName>
+ClassName & l_checkClassRef(lua_State *l, int n)
+{
+    ClassName* obj = l_checkClass<ClassName>(l, n);
+    if(obj == NULL)
+    {
+        typedef typename std::remove_cv<ClassName>::type Type;
+        luaL_error(l, "bad argument #%d (%s expected)", n, getClassName<Type>().c_str());
+    }
+    return *obj;
+}
 
+/**
+ * 	\param 		l the lua_state*
+ * 	\param 		size the size of what follows the header
+ * 	\param 		info the ClassInfo of the object
+ * 	\param 		mode how the userdata holds the object
+ * 	\return 	the header of the new userdata, the object is not set.
+ * 	\author 	Stud
+ * 	\brief 		Push a userdata big enough for the header and size bytes,
+ * 				the header is filled with the type tag.
+ * */
+inline ObjectHeader* newObjectHeader(lua_State *l, std::size_t size, const ClassInfo& info, ObjectHeader::Mode mode)
+{
+    ObjectHeader* header = static_cast<ObjectHeader*>(
+                lua_newuserdata(l, sizeof(ObjectHeader) + size));
+    header->magic = ObjectHeader::MAGIC;
+    header->mode = mode;
+    header->info = &info;
+    header->object = NULL;
+    header->destroy = NULL;
+    CPPLUA_INSTANCE_CREATED(info, sizeof(ObjectHeader) + size);
+    return header;
+}
 
+/**
+ * 	\param 		header the header of a userdata that holds a ClassName
+ * 	\author 	Stud
+ * 	\brief 		Calls the destructor of an object built in the userdata.
+ * */
+template <typename ClassName>
+void destroyObject(ObjectHeader* header)
+{
+    static_cast<ClassName*>(header->object)->~ClassName();
+}
+
+/**
+ * 	\param 		header the header of a userdata that holds a smart pointer
+ * 	\author 	Stud
+ * 	\brief 		Destroys the smart pointer held after the header.
+ * */
+template <typename Pointer>
+void destroyPointer(ObjectHeader* header)
+{
+    reinterpret_cast<Pointer*>(header + 1)->~Pointer();
+}
+
+/**
+ * 	\param 		l the lua_state*
+ * 	\return 	the memory where the object must be built.
+ * 	\author 	Stud
+ * 	\brief 		Push a userdata big enough for the header and an object of
+ * 				type ClassName, the header is filled with the type tag.
+ * 				The object must be built before the next call to Lua, __gc
+ * 				destroys it.
+ * */
+template <typename ClassName>
+void* newObject(lua_State *l)
+{
+    ObjectHeader* header = newObjectHeader(l, sizeof(ClassName), getClassInfo<ClassName>(), ObjectHeader::VALUE);
+    header->object = header + 1;
+    header->destroy = &destroyObject<ClassName>;
+    return header->object;
+}
+
+/**
+ * 	\param 		l the lua_state*
+ * 	\param 		obj the object owned by C++
+ * 	\author 	Stud
+ * 	\brief 		Push a userdata that points to obj. Lua never destroys
+ * 				the object, C++ must keep it alive while Lua uses it.
+ * */
+template <typename ClassName>
+void newBorrowedObject(lua_State *l, ClassName* obj)
+{
+    typedef typename std::remove_cv<ClassName>::type Type;
+    ObjectHeader* header = newObjectHeader(l, 0, getClassInfo<Type>(), ObjectHeader::BORROWED);
+    header->object = const_cast<Type*>(obj);
+}
 
 #endif
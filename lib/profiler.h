@@ -0,0 +1,468 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/**
+ * Copyright (c) 2014 Domora
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/** A sampling profiler for a lua_State, built on lua_sethook.
+ *
+ *  Every `instructions` VM instructions the hook takes the stack of the
+ *  state and adds the time elapsed since the previous sample to it (capped
+ *  by max_gap, so that the time spent outside of Lua is not counted). The
+ *  time spent in a C++ function called from Lua is therefore given to its
+ *  Lua caller. With trace_native, the call and return hooks are also set
+ *  and the time of the C functions is measured exactly, as a frame of its
+ *  own; it costs a hook on every call.
+ *
+ *  The C functions are named when they are first sampled, after where
+ *  they are bound: a method of a class is "Class.name" (found in the
+ *  metatables of the classes), a function of a module "Module.name" or
+ *  "Module.Class.name" (found in package.loaded). The registration costs
+ *  nothing and the profiler can be started at any time. A C function found
+ *  nowhere is named by the calling Lua code.
+ *
+ *  The hook is set on the thread given to start(), the coroutines created
+ *  afterwards inherit it (lua_newthread copies it), the older ones are not
+ *  sampled.
+ *
+ *  The samples are written in the folded format of the flame graph tools:
+ *  one line per stack, the frames from the outermost separated by ';',
+ *  then the time in microseconds.
+ *
+ *  In Lua: Profiler = require("Profiler")
+ *          Profiler.start([instructions], [trace_native]) ... Profiler.stop()
+ *          Profiler.write("profile.folded") */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include "lua5.2/lua.h"
+#include "lua5.2/lualib.h"
+#include "lua5.2/lauxlib.h"
+}
+
+class Profiler
+{
+public:
+    Profiler() :
+        running_(false),
+        max_gap_(std::chrono::milliseconds(10))
+    {}
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    /**
+     * \param 	l lua_State*
+     * \param 	instructions number of VM instructions between two samples,
+     *          the lower the more precise and the more expensive
+     * \param 	trace_native true to measure the C functions exactly
+     * \author 	Stud
+     */
+    void start(lua_State* l, int instructions = 1000, bool trace_native = false)
+    {
+        running_ = true;
+        last_ = Clock::now();
+        int mask = LUA_MASKCOUNT;
+        if(trace_native)
+            mask |= LUA_MASKCALL | LUA_MASKRET;
+        lua_sethook(l, &Profiler::hook, mask, instructions > 0 ? instructions : 1);
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \author 	Stud
+     * \brief 	Removes the hook, the samples are kept.
+     */
+    void stop(lua_State* l)
+    {
+        running_ = false;
+        lua_sethook(l, NULL, 0, 0);
+    }
+
+    bool running() const
+    {
+        return running_;
+    }
+
+    /**
+     * \param 	gap the longest time given to one sample
+     * \author 	Stud
+     */
+    void set_max_gap(std::chrono::microseconds gap)
+    {
+        max_gap_ = gap;
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \author 	Stud
+     * \brief 	Removes the samples and the names of the C functions.
+     */
+    void clear(lua_State* l)
+    {
+        samples_.clear();
+        reset_names(l);
+    }
+
+    /** The time in ns of each folded stack */
+    const std::unordered_map<std::string, uint64_t>& samples() const
+    {
+        return samples_;
+    }
+
+    /**
+     * \param 	path the file to write
+     * \return 	false if the file cannot be written
+     * \author 	Stud
+     * \brief 	Writes the samples in the folded format, in microseconds.
+     */
+    bool write(const char* path) const
+    {
+        FILE* f = fopen(path, "w");
+        if(f == NULL)
+            return false;
+        for(auto it = samples_.begin(); it != samples_.end(); ++it)
+        {
+            const unsigned long long us = (it->second + 500) / 1000;
+            if(us > 0)
+                fprintf(f, "%s %llu\n", it->first.c_str(), us);
+        }
+        return fclose(f) == 0;
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \return 	the profiler of the state, created on the first call
+     * \author 	Stud
+     */
+    static Profiler& get(lua_State* l)
+    {
+        lua_rawgetp(l, LUA_REGISTRYINDEX, &key());
+        Profiler* profiler = static_cast<Profiler*>(lua_touserdata(l, -1));
+        lua_pop(l, 1);
+        if(profiler != NULL)
+            return *profiler;
+
+        profiler = new(lua_newuserdata(l, sizeof(Profiler))) Profiler();
+        lua_createtable(l, 0, 1);
+        lua_pushcfunction(l, [](lua_State* l) {
+            static_cast<Profiler*>(lua_touserdata(l, 1))->~Profiler();
+            return 0;
+        });
+        lua_setfield(l, -2, "__gc");
+        lua_setmetatable(l, -2);
+        lua_rawsetp(l, LUA_REGISTRYINDEX, &key());
+        reset_names(l);
+        return *profiler;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static const char& key()
+    {
+        static const char k = 0;
+        return k;
+    }
+
+    static const char& names_key()
+    {
+        static const char k = 0;
+        return k;
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \brief 	A new table of the names of the C functions sampled, indexed
+     *          by the functions (false when they are not bound). The keys
+     *          are weak, the closures created per call are still collected.
+     */
+    static void reset_names(lua_State* l)
+    {
+        lua_newtable(l);
+        lua_createtable(l, 0, 1);
+        lua_pushliteral(l, "k");
+        lua_setfield(l, -2, "__mode");
+        lua_setmetatable(l, -2);
+        lua_rawsetp(l, LUA_REGISTRYINDEX, &names_key());
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \param 	table index of a table
+     * \param 	function index of the function
+     * \param 	key filled with the key of the function in the table
+     * \return 	true if the function is a value of the table with a string key
+     */
+    static bool find_key(lua_State* l, int table, int function, std::string& key)
+    {
+        lua_pushnil(l);
+        while(lua_next(l, table) != 0)
+        {
+            if(lua_type(l, -2) == LUA_TSTRING && lua_rawequal(l, -1, function))
+            {
+                key = lua_tostring(l, -2);
+                lua_pop(l, 2);
+                return true;
+            }
+            lua_pop(l, 1);
+        }
+        return false;
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \param 	function index of the C function
+     * \brief 	Pushes the name of the function where it is bound, false if
+     *          it is not found. Only called the first time a function is
+     *          sampled.
+     */
+    static void push_name(lua_State* l, int function)
+    {
+        function = lua_absindex(l, function);
+        std::string name;
+        //The metatables of the classes are in the registry under the names
+        //of the classes. The methods are flattened, an inherited method is
+        //named after the class with the fewest methods: the one declaring it
+        std::size_t fewest = 0;
+        lua_pushnil(l);
+        while(lua_next(l, LUA_REGISTRYINDEX) != 0)
+        {
+            if(lua_type(l, -2) == LUA_TSTRING && lua_istable(l, -1))
+            {
+                lua_pushliteral(l, "_methods");
+                lua_rawget(l, -2);
+                std::string method;
+                if(lua_istable(l, -1) && find_key(l, lua_gettop(l), function, method))
+                {
+                    std::size_t count = 0;
+                    for(lua_pushnil(l); lua_next(l, -2) != 0; lua_pop(l, 1))
+                        ++count;
+                    if(name.empty() || count < fewest)
+                    {
+                        name = std::string(lua_tostring(l, -3)) + "." + method;
+                        fewest = count;
+                    }
+                }
+                lua_pop(l, 1);
+            }
+            lua_pop(l, 1);
+        }
+        if(name.empty())
+            find_module_function(l, function, name);
+        if(name.empty())
+            lua_pushboolean(l, 0);
+        else
+            lua_pushstring(l, name.c_str());
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \param 	function index of the C function
+     * \param 	name filled with "Module.name" or "Module.Class.name"
+     */
+    static void find_module_function(lua_State* l, int function, std::string& name)
+    {
+        lua_getfield(l, LUA_REGISTRYINDEX, "_LOADED");
+        const int loaded = lua_gettop(l);
+        lua_pushnil(l);
+        while(name.empty() && lua_next(l, loaded) != 0)
+        {
+            //_G holds the other modules
+            if(lua_type(l, -2) == LUA_TSTRING && lua_istable(l, -1) && std::strcmp(lua_tostring(l, -2), "_G") != 0)
+            {
+                const int module = lua_gettop(l);
+                std::string key;
+                if(find_key(l, module, function, key))
+                    name = std::string(lua_tostring(l, module - 1)) + "." + key;
+                else
+                {
+                    //The static functions are in the tables of the classes
+                    lua_pushnil(l);
+                    while(lua_next(l, module) != 0)
+                    {
+                        if(lua_type(l, -2) == LUA_TSTRING && lua_istable(l, -1)
+                                && find_key(l, lua_gettop(l), function, key))
+                        {
+                            name = std::string(lua_tostring(l, module - 1)) + "." + lua_tostring(l, -2) + "." + key;
+                            lua_pop(l, 2);
+                            break;
+                        }
+                        lua_pop(l, 1);
+                    }
+                }
+            }
+            lua_pop(l, 1);
+        }
+        lua_settop(l, loaded - 1);
+    }
+
+    /**
+     * \param 	l lua_State*
+     * \param 	first the first level of the stack, 1 to skip the running
+     *          function
+     * \return 	the folded stack, from the outermost frame
+     */
+    static std::string folded_stack(lua_State* l, int first)
+    {
+        std::vector<std::string> frames;
+        lua_Debug ar;
+        lua_rawgetp(l, LUA_REGISTRYINDEX, &names_key());
+        for(int level = first; lua_getstack(l, level, &ar); ++level)
+        {
+            lua_getinfo(l, "Snf", &ar);
+            std::string frame;
+            if(ar.what[0] == 'C')
+            {
+                lua_pushvalue(l, -1);
+                lua_rawget(l, -3);
+                if(lua_isnil(l, -1))
+                {
+                    //First sample of the function
+                    lua_pop(l, 1);
+                    push_name(l, -1);
+                    lua_pushvalue(l, -2);
+                    lua_pushvalue(l, -2);
+                    lua_rawset(l, -5);
+                }
+                const char* name = lua_tostring(l, -1);
+                frame = name != NULL ? name : (ar.name != NULL ? ar.name : "?");
+                lua_pop(l, 1);
+            }
+            else
+            {
+                frame = ar.what[0] == 'm' ? "main" : (ar.name != NULL ? ar.name : "?");
+                frame += "@";
+                frame += ar.short_src;
+                frame += ":" + std::to_string(ar.linedefined);
+            }
+            lua_pop(l, 1);
+            //';' separates the frames in the folded format
+            for(std::size_t i = 0; i < frame.size(); ++i)
+            {
+                if(frame[i] == ';' || frame[i] == ' ')
+                    frame[i] = '_';
+            }
+            frames.push_back(frame);
+        }
+        lua_pop(l, 1);
+        std::string stack;
+        for(std::size_t i = frames.size(); i > 0; --i)
+        {
+            stack += frames[i - 1];
+            if(i > 1)
+                stack += ';';
+        }
+        return stack;
+    }
+
+    /**
+     * \param 	stack the folded stack
+     * \param 	now the time of the event
+     * \brief 	Gives the time since the previous event to the stack.
+     */
+    void add(const std::string& stack, Clock::time_point now)
+    {
+        auto elapsed = now - last_;
+        if(elapsed > max_gap_)
+            elapsed = max_gap_;
+        last_ = now;
+        if(!stack.empty())
+            samples_[stack] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+
+    static void hook(lua_State* l, lua_Debug* ar)
+    {
+        const Clock::time_point now = Clock::now();
+        Profiler& profiler = get(l);
+        if(ar->event == LUA_HOOKCOUNT)
+        {
+            profiler.add(folded_stack(l, 0), now);
+            return;
+        }
+        //The call and return hooks only matter for the C functions
+        lua_getinfo(l, "S", ar);
+        if(ar->what[0] != 'C')
+            return;
+        if(ar->event == LUA_HOOKCALL)
+            profiler.add(folded_stack(l, 1), now); //Up to the call, to the caller
+        else if(ar->event == LUA_HOOKRET)
+            profiler.add(folded_stack(l, 0), now); //The call itself
+    }
+
+    bool running_;
+    Clock::duration max_gap_;
+    Clock::time_point last_;
+    std::unordered_map<std::string, uint64_t> samples_;
+};
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Lua function Profiler.start([instructions], [trace_native])
+ */
+inline int profiler_start(lua_State* l)
+{
+    Profiler::get(l).start(l, static_cast<int>(luaL_optinteger(l, 1, 1000)), lua_toboolean(l, 2) != 0);
+    return 0;
+}
+
+/**
+ * \brief 	Lua function Profiler.stop()
+ */
+inline int profiler_stop(lua_State* l)
+{
+    Profiler::get(l).stop(l);
+    return 0;
+}
+
+/**
+ * \brief 	Lua function Profiler.write(path), returns true on success
+ */
+inline int profiler_write(lua_State* l)
+{
+    lua_pushboolean(l, Profiler::get(l).write(luaL_checkstring(l, 1)));
+    return 1;
+}
+
+/**
+ * \brief 	Lua function Profiler.clear()
+ */
+inline int profiler_clear(lua_State* l)
+{
+    Profiler::get(l).clear(l);
+    return 0;
+}
+
+/**
+ * \param 	l lua_State*
+ * \author 	Stud
+ * \brief 	Loader of the profiler module, register it with
+ *          registerModule<load_profiler>(l, "Profiler").
+ */
+inline int load_profiler(lua_State* l)
+{
+    lua_pushcfunction(l, profiler_start);
+    lua_setfield(l, -2, "start");
+    lua_pushcfunction(l, profiler_stop);
+    lua_setfield(l, -2, "stop");
+    lua_pushcfunction(l, profiler_write);
+    lua_setfield(l, -2, "write");
+    lua_pushcfunction(l, profiler_clear);
+    lua_setfield(l, -2, "clear");
+    return 0;
+}
+
+#endif
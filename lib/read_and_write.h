@@ -9,6 +9,15 @@
  */
 
 #include <memory>
+#include <new>
+#include <string>
+#include <functional>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <array>
+#include <map>
+#include <unordered_map>
 
 extern "C" {
 #include "lua5.2/lua.h"
@@ -21,6 +30,18 @@ extern "C" {
 #include "luaref_tracker.h"
 #include "optional.hpp"
 
+#if __cplusplus >= 201703L
+#include <string_view>
+#define CPPLUA_HAS_STRING_VIEW
+#endif
+
+#if __cplusplus > 201703L && __has_include(<span>)
+#include <span>
+#ifdef __cpp_lib_span
+#define CPPLUA_HAS_SPAN
+#endif
+#endif
+
 template <typename Ret, typename... Args>
 typename std::enable_if<std::is_void<Ret>::value, std::function<Ret(Args...)> >::type
 _get(_id<std::function<Ret(Args...)> >, lua_State *l, const int index);
@@ -40,6 +61,104 @@ inline int _get(_id<int>, lua_State *l, const int index);
 inline unsigned int _get(_id<unsigned int>, lua_State *l, const int index);
 inline lua_Number _get(_id<lua_Number>, lua_State *l, const int index);
 inline std::string _get(_id<std::string>, lua_State *l, const int index);
+inline const char* _get(_id<const char*>, lua_State *l, const int index);
+#ifdef CPPLUA_HAS_STRING_VIEW
+inline std::string_view _get(_id<std::string_view>, lua_State *l, const int index);
+#endif
+
+/**
+  * \brief 	Containers are converted from and to tables, a const reference
+  *          on a container is read as a value.
+  */
+template <typename T, typename Alloc>
+struct is_primitive<std::vector<T, Alloc> > {
+    static constexpr bool value = true;
+};
+
+template <typename T, std::size_t N>
+struct is_primitive<std::array<T, N> > {
+    static constexpr bool value = true;
+};
+
+template <typename K, typename V, typename Compare, typename Alloc>
+struct is_primitive<std::map<K, V, Compare, Alloc> > {
+    static constexpr bool value = true;
+};
+
+template <typename K, typename V, typename Hash, typename Pred, typename Alloc>
+struct is_primitive<std::unordered_map<K, V, Hash, Pred, Alloc> > {
+    static constexpr bool value = true;
+};
+
+template <typename T>
+struct is_primitive<std::shared_ptr<T> > {
+    static constexpr bool value = true;
+};
+
+template <typename T, typename D>
+struct is_primitive<std::unique_ptr<T, D> > {
+    static constexpr bool value = true;
+};
+
+template <typename T>
+inline std::shared_ptr<T> _get(_id<std::shared_ptr<T> >, lua_State *l, const int index);
+
+template <typename T, typename D>
+inline std::unique_ptr<T, D> _get(_id<std::unique_ptr<T, D> >, lua_State *l, const int index);
+
+template <typename T, typename Alloc>
+inline std::vector<T, Alloc> _get(_id<std::vector<T, Alloc> >, lua_State *l, const int index);
+
+template <typename T, std::size_t N>
+inline std::array<T, N> _get(_id<std::array<T, N> >, lua_State *l, const int index);
+
+template <typename K, typename V, typename Compare, typename Alloc>
+inline std::map<K, V, Compare, Alloc> _get(_id<std::map<K, V, Compare, Alloc> >, lua_State *l, const int index);
+
+template <typename K, typename V, typename Hash, typename Pred, typename Alloc>
+inline std::unordered_map<K, V, Hash, Pred, Alloc> _get(_id<std::unordered_map<K, V, Hash, Pred, Alloc> >, lua_State *l, const int index);
+
+struct nil;
+
+inline void _push(lua_State *l, bool b);
+inline void _push(lua_State *l, int i);
+inline void _push(lua_State *l, unsigned int u);
+inline void _push(lua_State *l, lua_Number f);
+inline void _push(lua_State *l, const std::string& s);
+inline void _push(lua_State *l, const char *s);
+#ifdef CPPLUA_HAS_STRING_VIEW
+inline void _push(lua_State *l, std::string_view s);
+#endif
+inline void _push(lua_State *l, nil);
+
+template <typename... Ts>
+inline void _push(lua_State *l, const std::tuple<Ts...>& t);
+
+template <typename T1, typename T2>
+inline void _push(lua_State *l, const std::pair<T1, T2>& p);
+
+template <typename T>
+inline void _push(lua_State *l, std::shared_ptr<T> p);
+
+template <typename T, typename D>
+inline void _push(lua_State *l, std::unique_ptr<T, D> p);
+
+template <typename T, typename Alloc>
+inline void _push(lua_State *l, const std::vector<T, Alloc>& v);
+
+template <typename T, std::size_t N>
+inline void _push(lua_State *l, const std::array<T, N>& a);
+
+#ifdef CPPLUA_HAS_SPAN
+template <typename T, std::size_t N>
+inline void _push(lua_State *l, std::span<T, N> s);
+#endif
+
+template <typename K, typename V, typename Compare, typename Alloc>
+inline void _push(lua_State *l, const std::map<K, V, Compare, Alloc>& m);
+
+template <typename K, typename V, typename Hash, typename Pred, typename Alloc>
+inline void _push(lua_State *l, const std::unordered_map<K, V, Hash, Pred, Alloc>& m);
 
 using namespace std::experimental;
 
@@ -121,7 +240,9 @@ inline T read(lua_State* l, const int index) {
  */
 template <typename T>
 T* _get(_id<T*>, lua_State *l, const int index) {
-    return static_cast<T*>(lua_touserdata(l, index));
+    if(lua_islightuserdata(l, index))
+        return static_cast<T*>(lua_touserdata(l, index));
+    return l_checkClass<T>(l, index);
 }
 
 /**
@@ -136,7 +257,7 @@ template <typename T>
 T& _get(_id<T&>, lua_State *l, const int index) {
     static_assert(!is_primitive<T>::value,
                   "Reference types must not be primitives.");
-    return (*l_checkClass<T>(l, index));
+    return l_checkClassRef<T>(l, index);
 }
 
 /**
@@ -149,7 +270,53 @@ T& _get(_id<T&>, lua_State *l, const int index) {
  */
 template <typename T>
 T _get(_id<T>, lua_State *l, const int index) {
-    return (*l_checkClass<T>(l, index));
+    return l_checkClassRef<T>(l, index);
+}
+
+/**
+ * \author 	Stud
+ * \param 	l lua_State*
+ * \brief 	Message handler of the callbacks, adds the traceback to the
+ *          error message.
+ */
+inline int callback_message_handler(lua_State *l)
+{
+    const char* msg = lua_tostring(l, 1);
+    luaL_traceback(l, l, msg != NULL ? msg : "(error object is not a string)", 1);
+    return 1;
+}
+
+/**
+ * \author 	Stud
+ * \param 	l the thread where the function is called
+ * \param 	callback the tracked function
+ * \param 	args the arguments of the function
+ * \return 	true if the function has been called without error
+ * \brief 	Calls the function in protected mode with a message handler.
+ *          The handler and the results are left on the stack, above top.
+ */
+template <typename... Args>
+inline bool call_callback(lua_State* l, const LuarefTracker& callback, const int results, Args&&... args)
+{
+    //Push the message handler
+    lua_pushcfunction(l, callback_message_handler);
+    const int handler = lua_gettop(l);
+    //Get the function
+    callback.push(l);
+    //Push the arguments on the stack
+    push(l, nil(), std::forward<Args>(args)...);
+    constexpr int num_args = sizeof...(Args) + 1;
+    //Call the function
+    return lua_pcall(l, num_args, results, handler) == 0;
+}
+
+/**
+ * \brief 	Same as above on the thread where the callback was read.
+ */
+template <typename... Args>
+inline bool call_callback(const LuarefTracker& callback, const int results, Args&&... args)
+{
+    return call_callback(callback.get_state(), callback, results, std::forward<Args>(args)...);
 }
 
 /**
@@ -159,26 +326,21 @@ T _get(_id<T>, lua_State *l, const int index) {
  * \param 	index index on the stack
  *
  * \param 	_id<T> default type (userdata)
- * \brief 	Read reference on the Lua stack.
+ * \brief 	Read reference on the Lua stack. The errors are printed, the
+ *          stack of the caller is left as it was.
  */
 template <typename Ret, typename... Args>
 typename std::enable_if<std::is_void<Ret>::value, std::function<Ret(Args...)> >::type
 _get(_id<std::function<Ret(Args...)> >, lua_State *l, const int index)
 {
-    std::shared_ptr<LuarefTracker> luarefTracker(new LuarefTracker(l, index));
-    auto lambda = [l, luarefTracker](Args... args) {
-        //Get the reference
-        lua_rawgeti(l, LUA_REGISTRYINDEX, luarefTracker->get_ref());
-        //Push the arguments on the stack
-        push(l, nil(), args...);
-        constexpr int num_args = sizeof...(Args) + 1;
-        //Call the function
-        if (lua_pcall(l, num_args, 0, 0) != 0)
-            printf("error running function `f': %s\n",lua_tostring(l, -1));
-
-        lua_settop(l, 0);
+    LuarefTracker callback(l, index);
+    return [callback](Args... args) {
+        lua_State* l = callback.get_state();
+        const int top = lua_gettop(l);
+        if(!call_callback(callback, 0, args...))
+            fprintf(stderr, "error running function `f': %s\n", lua_tostring(l, -1));
+        lua_settop(l, top);
     };
-    return lambda;
 }
 
 /**
@@ -187,28 +349,28 @@ _get(_id<std::function<Ret(Args...)> >, lua_State *l, const int index)
  * \param 	l lua_State*
  * \param 	index index on the stack
  * \param 	_id<std::function<Ret(Args...)> > dummy struct indicate a function pointer
- * \brief 	Read reference on the Lua stack.
+ * \brief 	Read reference on the Lua stack. The errors are raised again
+ *          with the traceback, the stack of the caller is left as it was.
  */
 template <typename Ret, typename... Args>
 typename std::enable_if<!std::is_void<Ret>::value, std::function<Ret(Args...)> >::type
 _get(_id<std::function<Ret(Args...)> >, lua_State *l, const int index)
 {
-    lua_pushvalue(l, index);
-    int ref = luaL_ref(l, LUA_REGISTRYINDEX);
-    std::shared_ptr<LuarefTracker> luarefTracker(new LuarefTracker(l, ref));
-    auto lambda = [l, ref, luarefTracker](Args... args) {
-        //Get the reference
-        lua_rawgeti(l, LUA_REGISTRYINDEX, ref);
-        //Push the arguments on the stack
-        push(l, nil(), args...);
-        constexpr int num_args = sizeof...(Args) + 1;
-        //Call the function
-        lua_call(l, num_args, 1);
+    LuarefTracker callback(l, index);
+    return [callback](Args... args) {
+        lua_State* l = callback.get_state();
+        const int top = lua_gettop(l);
+        if(!call_callback(callback, 1, args...))
+        {
+            //Keep the message only and raise it again
+            lua_replace(l, top + 1);
+            lua_settop(l, top + 1);
+            lua_error(l);
+        }
         Ret ret = read<Ret>(l, -1);
-        lua_settop(l, 0);
+        lua_settop(l, top);
         return ret;
     };
-    return lambda;
 }
 
 /**
@@ -288,6 +450,193 @@ std::string _get(_id<std::string>, lua_State *l, const int index) {
     return std::string{buff, size};
 }
 
+/**
+ * \author 	Stud
+ * \param 	_id tag that gives the type
+ * \param 	l lua_State*
+ * \param 	index index on the stack
+ * \param 	_id<const char*> dummy struct indicate a C string
+ * \brief 	Reads a C string on the Lua stack without copying it. The
+ *          pointer is valid as long as the value stays on the stack, which
+ *          is the case during the call of a bound function.
+ */
+inline const char* _get(_id<const char*>, lua_State *l, const int index) {
+    return lua_tostring(l, index);
+}
+
+#ifdef CPPLUA_HAS_STRING_VIEW
+/**
+ * \author 	Stud
+ * \param 	_id tag that gives the type
+ * \param 	l lua_State*
+ * \param 	index index on the stack
+ * \param 	_id<std::string_view> dummy struct indicate a string view
+ * \brief 	Reads a view on a Lua string without copying it. The view is
+ *          valid as long as the value stays on the stack.
+ */
+inline std::string_view _get(_id<std::string_view>, lua_State *l, const int index) {
+    size_t size;
+    const char *buff = lua_tolstring(l, index, &size);
+    if(buff == NULL)
+        return std::string_view();
+    return std::string_view(buff, size);
+}
+#endif
+
+/**
+ * \author 	Stud
+ * \param 	_id tag that gives the type
+ * \param 	l lua_State*
+ * \param 	index index on the stack
+ * \param 	_id<std::shared_ptr<T> > dummy struct indicate a shared pointer
+ * \brief 	Reads an object pushed as a shared pointer. The pointer shares
+ *          the ownership of the userdata's pointer, nil gives an empty
+ *          pointer.
+ */
+template <typename T>
+inline std::shared_ptr<T> _get(_id<std::shared_ptr<T> >, lua_State *l, const int index) {
+    if(lua_isnoneornil(l, index))
+        return std::shared_ptr<T>();
+    T& obj = l_checkClassRef<T>(l, index);
+    ObjectHeader* header = toObjectHeader(l, index);
+    if(header->mode != ObjectHeader::SHARED)
+        luaL_error(l, "bad argument #%d (shared %s expected)", index, getClassName<typename std::remove_cv<T>::type>().c_str());
+    //Aliasing constructor, the owner is the pointer held by the userdata
+    return std::shared_ptr<T>(*reinterpret_cast<std::shared_ptr<void>*>(header + 1), &obj);
+}
+
+/**
+ * \author 	Stud
+ * \param 	_id tag that gives the type
+ * \param 	l lua_State*
+ * \param 	index index on the stack
+ * \param 	_id<std::unique_ptr<T> > dummy struct indicate a unique pointer
+ * \brief 	Takes the ownership of an object pushed as a unique pointer of
+ *          the same type, the userdata cannot be used anymore.
+ */
+template <typename T, typename D>
+inline std::unique_ptr<T, D> _get(_id<std::unique_ptr<T, D> >, lua_State *l, const int index) {
+    typedef std::unique_ptr<T, D> Pointer;
+    if(lua_isnoneornil(l, index))
+        return Pointer();
+    ObjectHeader* header = toObjectHeader(l, index);
+    if(header == NULL || header->mode != ObjectHeader::UNIQUE
+            || header->info != &getClassInfo<typename std::remove_cv<T>::type>()
+            || header->destroy != &destroyPointer<Pointer>)
+        luaL_error(l, "bad argument #%d (unique %s expected)", index, getClassName<typename std::remove_cv<T>::type>().c_str());
+    header->object = NULL;
+    return std::move(*reinterpret_cast<Pointer*>(header + 1));
+}
+
+/**
+ * \author 	Stud
+ * \param 	l lua_State*
+ * \param 	index index of the table on the stack
+ * \param 	out iterator that receives the values
+ * \param 	size number of values to read
+ * \brief 	Reads the values 1 to size of the table with raw accesses.
+ */
+template <typename T, typename OutputIt>
+inline void _get_sequence(lua_State *l, const int index, OutputIt out, const std::size_t size) {
+    const int table = lua_absindex(l, index);
+    for(std::size_t i = 0; i < size; ++i, ++out)
+    {
+        lua_rawgeti(l, table, i + 1);
+        *out = read<T>(l, -1);
+        lua_pop(l, 1);
+    }
+}
+
+/**
+ * \author 	Stud
+ * \param 	l lua_State*
+ * \param 	index index of the table on the stack
+ * \param 	m map that receives the pairs of the table
+ * \brief 	Reads every pair of the table. The key is copied before it
+ *          is read so that reading a number as a string does not change
+ *          the key used by lua_next.
+ */
+template <typename K, typename V, typename Map>
+inline void _get_pairs(lua_State *l, const int index, Map& m) {
+    const int table = lua_absindex(l, index);
+    lua_pushnil(l);
+    while(lua_next(l, table) != 0)
+    {
+        lua_pushvalue(l, -2);
+        m.emplace(read<K>(l, -1), read<V>(l, -2));
+        lua_pop(l, 2);
+    }
+}
+
+/**
+ * \author 	Stud
+ * \param 	_id tag that gives the type
+ * \param 	l lua_State*
+ * \param 	index index on the stack
+ * \param 	_id<std::vector<T> > dummy struct indicate a vector
+ * \brief 	Reads the sequence part of a table in a vector, raises an
+ *          error if the value is not a table
+ */
+template <typename T, typename Alloc>
+inline std::vector<T, Alloc> _get(_id<std::vector<T, Alloc> >, lua_State *l, const int index) {
+    luaL_checktype(l, index, LUA_TTABLE);
+    std::vector<T, Alloc> v(lua_rawlen(l, index));
+    _get_sequence<T>(l, index, v.begin(), v.size());
+    return v;
+}
+
+/**
+ * \author 	Stud
+ * \param 	_id tag that gives the type
+ * \param 	l lua_State*
+ * \param 	index index on the stack
+ * \param 	_id<std::array<T, N> > dummy struct indicate an array
+ * \brief 	Reads the N first values of a table in an array, the missing
+ *          values are value initialized. Raises an error if the value is
+ *          not a table.
+ */
+template <typename T, std::size_t N>
+inline std::array<T, N> _get(_id<std::array<T, N> >, lua_State *l, const int index) {
+    luaL_checktype(l, index, LUA_TTABLE);
+    std::array<T, N> a{};
+    _get_sequence<T>(l, index, a.begin(), std::min<std::size_t>(N, lua_rawlen(l, index)));
+    return a;
+}
+
+/**
+ * \author 	Stud
+ * \param 	_id tag that gives the type
+ * \param 	l lua_State*
+ * \param 	index index on the stack
+ * \param 	_id<std::map<K, V> > dummy struct indicate a map
+ * \brief 	Reads the pairs of a table in a map, raises an error if the
+ *          value is not a table
+ */
+template <typename K, typename V, typename Compare, typename Alloc>
+inline std::map<K, V, Compare, Alloc> _get(_id<std::map<K, V, Compare, Alloc> >, lua_State *l, const int index) {
+    luaL_checktype(l, index, LUA_TTABLE);
+    std::map<K, V, Compare, Alloc> m;
+    _get_pairs<K, V>(l, index, m);
+    return m;
+}
+
+/**
+ * \author 	Stud
+ * \param 	_id tag that gives the type
+ * \param 	l lua_State*
+ * \param 	index index on the stack
+ * \param 	_id<std::unordered_map<K, V> > dummy struct indicate a hash map
+ * \brief 	Reads the pairs of a table in an unordered map, raises an
+ *          error if the value is not a table
+ */
+template <typename K, typename V, typename Hash, typename Pred, typename Alloc>
+inline std::unordered_map<K, V, Hash, Pred, Alloc> _get(_id<std::unordered_map<K, V, Hash, Pred, Alloc> >, lua_State *l, const int index) {
+    luaL_checktype(l, index, LUA_TTABLE);
+    std::unordered_map<K, V, Hash, Pred, Alloc> m;
+    _get_pairs<K, V>(l, index, m);
+    return m;
+}
+
 /**
  * \author 	Stud
  * \param 	_id tag that gives the type
@@ -388,12 +737,103 @@ void _push(lua_State *l) {}
 /**
   * \author 	Stud
   * \param 	l lua_State*
-  * \brief 	Push a pointer
+  * \param 	data the pointer
+  * \brief 	Push a pointer. A pointer on a registered class is borrowed:
+  *          the userdata has the metatable of the class but Lua never
+  *          destroys the object. Other pointers are light userdata.
+  */
+template <typename T>
+typename std::enable_if<std::is_pointer<T>::value>::type
+_push(lua_State *l, T data)
+{
+    typedef typename std::remove_cv<typename std::remove_pointer<T>::type>::type Type;
+    if(std::is_class<Type>::value && data != NULL)
+    {
+        getClassMetatable<Type>(l);
+        if(lua_istable(l, -1))
+        {
+            newBorrowedObject(l, data);
+            lua_insert(l, -2);
+            lua_setmetatable(l, -2);
+            return;
+        }
+        lua_pop(l, 1);
+    }
+    lua_pushlightuserdata(l, const_cast<Type*>(data));
+}
+
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	value the object
+  * \brief 	Push an object of a registered class by value: it is moved
+  *          (or copied when it is not an rvalue) into a userdata that Lua
+  *          owns. Return a pointer to share an object owned by C++.
   */
 template <typename T>
-void _push(lua_State *l, T data )
+typename std::enable_if<std::is_class<T>::value>::type
+_push(lua_State *l, T value)
 {
-    lua_pushlightuserdata(l, data);
+    getClassMetatable<T>(l);
+    if(!lua_istable(l, -1))
+        luaL_error(l, "%s is not a registered class", getClassName<T>().c_str());
+    void* data = newObject<T>(l);
+    new(data) T(std::move(value));
+    lua_insert(l, -2);
+    lua_setmetatable(l, -2);
+}
+
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	p the shared pointer
+  * \brief 	Push an object of a registered class that Lua shares with
+  *          C++, the userdata holds a reference until it is collected.
+  */
+template <typename T>
+inline void _push(lua_State *l, std::shared_ptr<T> p) {
+    typedef typename std::remove_cv<T>::type Type;
+    if(!p)
+    {
+        lua_pushnil(l);
+        return;
+    }
+    getClassMetatable<Type>(l);
+    if(!lua_istable(l, -1))
+        luaL_error(l, "%s is not a registered class", getClassName<Type>().c_str());
+    ObjectHeader* header = newObjectHeader(l, sizeof(std::shared_ptr<void>), getClassInfo<Type>(), ObjectHeader::SHARED);
+    header->object = const_cast<Type*>(p.get());
+    new(header + 1) std::shared_ptr<void>(std::move(p));
+    header->destroy = &destroyPointer<std::shared_ptr<void> >;
+    lua_insert(l, -2);
+    lua_setmetatable(l, -2);
+}
+
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	p the unique pointer
+  * \brief 	Push an object of a registered class whose ownership is
+  *          given to Lua, the userdata holds the unique pointer.
+  */
+template <typename T, typename D>
+inline void _push(lua_State *l, std::unique_ptr<T, D> p) {
+    typedef std::unique_ptr<T, D> Pointer;
+    typedef typename std::remove_cv<T>::type Type;
+    if(!p)
+    {
+        lua_pushnil(l);
+        return;
+    }
+    getClassMetatable<Type>(l);
+    if(!lua_istable(l, -1))
+        luaL_error(l, "%s is not a registered class", getClassName<Type>().c_str());
+    ObjectHeader* header = newObjectHeader(l, sizeof(Pointer), getClassInfo<Type>(), ObjectHeader::UNIQUE);
+    header->object = const_cast<Type*>(p.get());
+    new(header + 1) Pointer(std::move(p));
+    header->destroy = &destroyPointer<Pointer>;
+    lua_insert(l, -2);
+    lua_setmetatable(l, -2);
 }
 
 /**
@@ -402,8 +842,7 @@ void _push(lua_State *l, T data )
   * \param 	b boolean
   * \brief 	Push a boolean on the Lua stack
   */
-template <>
-inline void _push<bool>(lua_State *l, bool b) {
+inline void _push(lua_State *l, bool b) {
     lua_pushboolean(l, b);
 }
 
@@ -413,8 +852,7 @@ inline void _push<bool>(lua_State *l, bool b) {
   * \param 	i int
   * \brief 	Push an int on the Lua stack
   */
-template <>
-inline void _push<int>(lua_State *l, int i) {
+inline void _push(lua_State *l, int i) {
     lua_pushinteger(l, i);
 }
 
@@ -424,8 +862,7 @@ inline void _push<int>(lua_State *l, int i) {
   * \param 	u unsigned int
   * \brief 	Push an unsigned int on the Lua stack
   */
-template <>
-inline void _push<unsigned int>(lua_State *l, unsigned int u) {
+inline void _push(lua_State *l, unsigned int u) {
     lua_pushunsigned(l, u);
 }
 
@@ -435,8 +872,7 @@ inline void _push<unsigned int>(lua_State *l, unsigned int u) {
   * \param 	f lua_Number
   * \brief 	Push other types of number on the Lua stack
   */
-template <>
-inline void _push<lua_Number>(lua_State *l, lua_Number f) {
+inline void _push(lua_State *l, lua_Number f) {
     lua_pushnumber(l, f);
 }
 
@@ -444,11 +880,12 @@ inline void _push<lua_Number>(lua_State *l, lua_Number f) {
   * \author 	Stud
   * \param 	l lua_State*
   * \param 	s std::string
-  * \brief 	Push an std::string on the Lua stack
+  * \brief 	Push an std::string on the Lua stack. The string is taken by
+  *          reference, returned references and temporaries are not copied
+  *          before Lua makes its own copy.
   */
-template <>
-inline void _push<std::string>(lua_State *l, std::string s) {
-    lua_pushlstring(l, s.c_str(), s.size());
+inline void _push(lua_State *l, const std::string& s) {
+    lua_pushlstring(l, s.data(), s.size());
 }
 
 /**
@@ -457,19 +894,29 @@ inline void _push<std::string>(lua_State *l, std::string s) {
   * \param 	s char*
   * \brief 	Push a char* on the Lua stack
   */
-template <>
-inline void _push<const char*>(lua_State *l, const char *s) {
+inline void _push(lua_State *l, const char *s) {
     lua_pushstring(l, s);
 }
 
+#ifdef CPPLUA_HAS_STRING_VIEW
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	s std::string_view
+  * \brief 	Push a string view on the Lua stack
+  */
+inline void _push(lua_State *l, std::string_view s) {
+    lua_pushlstring(l, s.data(), s.size());
+}
+#endif
+
 /**
   * \author 	Stud
   * \param 	l lua_State*
   * \param  n nil value
   * \brief 	Push a nil on the Lua stack
   */
-template <>
-inline void _push<nil>(lua_State *l, nil ) {
+inline void _push(lua_State *l, nil ) {
     lua_pushnil(l);
 }
 
@@ -487,4 +934,345 @@ inline void _push(lua_State *l, optional<T> o) {
         push(l, nil());
 }
 
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	t the tuple
+  * \param 	_indices trait used to unpack the tuple
+  * \brief 	Push each element of the tuple on the Lua stack
+  */
+template <typename... Ts, std::size_t... N>
+inline void _push_tuple(lua_State *l, const std::tuple<Ts...>& t, _indices<N...>) {
+    push(l, std::get<N>(t)...);
+}
+
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	t the tuple
+  * \brief 	Push the elements of the tuple as separate values, a function
+  *          that returns a tuple returns several values to Lua.
+  */
+template <typename... Ts>
+inline void _push(lua_State *l, const std::tuple<Ts...>& t) {
+    _push_tuple(l, t, typename _indices_builder<sizeof...(Ts)>::type());
+}
+
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	p the pair
+  * \brief 	Push the two elements of the pair as separate values
+  */
+template <typename T1, typename T2>
+inline void _push(lua_State *l, const std::pair<T1, T2>& p) {
+    push(l, p.first, p.second);
+}
+
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	first first value of the sequence
+  * \param 	last end of the sequence
+  * \param 	size number of values
+  * \brief 	Push a table presized for the sequence, filled with raw
+  *          accesses.
+  */
+template <typename InputIt>
+inline void _push_sequence(lua_State *l, InputIt first, InputIt last, const std::size_t size) {
+    lua_createtable(l, size, 0);
+    for(int i = 1; first != last; ++first, ++i)
+    {
+        push(l, *first);
+        lua_rawseti(l, -2, i);
+    }
+}
+
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	first first pair of the map
+  * \param 	last end of the map
+  * \param 	size number of pairs
+  * \brief 	Push a table presized for the pairs of the map
+  */
+template <typename InputIt>
+inline void _push_pairs(lua_State *l, InputIt first, InputIt last, const std::size_t size) {
+    lua_createtable(l, 0, size);
+    for(; first != last; ++first)
+    {
+        push(l, first->first, first->second);
+        lua_rawset(l, -3);
+    }
+}
+
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	v the vector
+  * \brief 	Push a vector as a sequence on the Lua stack
+  */
+template <typename T, typename Alloc>
+inline void _push(lua_State *l, const std::vector<T, Alloc>& v) {
+    _push_sequence(l, v.cbegin(), v.cend(), v.size());
+}
+
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	a the array
+  * \brief 	Push an array as a sequence on the Lua stack
+  */
+template <typename T, std::size_t N>
+inline void _push(lua_State *l, const std::array<T, N>& a) {
+    _push_sequence(l, a.cbegin(), a.cend(), N);
+}
+
+#ifdef CPPLUA_HAS_SPAN
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	s the span
+  * \brief 	Push the viewed values as a sequence on the Lua stack
+  */
+template <typename T, std::size_t N>
+inline void _push(lua_State *l, std::span<T, N> s) {
+    _push_sequence(l, s.begin(), s.end(), s.size());
+}
+#endif
+
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	m the map
+  * \brief 	Push a map as a table on the Lua stack
+  */
+template <typename K, typename V, typename Compare, typename Alloc>
+inline void _push(lua_State *l, const std::map<K, V, Compare, Alloc>& m) {
+    _push_pairs(l, m.cbegin(), m.cend(), m.size());
+}
+
+/**
+  * \author 	Stud
+  * \param 	l lua_State*
+  * \param 	m the unordered map
+  * \brief 	Push an unordered map as a table on the Lua stack
+  */
+template <typename K, typename V, typename Hash, typename Pred, typename Alloc>
+inline void _push(lua_State *l, const std::unordered_map<K, V, Hash, Pred, Alloc>& m) {
+    _push_pairs(l, m.cbegin(), m.cend(), m.size());
+}
+
+/**
+  * \author 	Stud
+  * \brief 	Number of values pushed on the Lua stack for a value of type
+  *          T, this is what a bound function returns to Lua.
+  */
+template <typename T>
+struct return_count {
+    static constexpr int value = 1;
+};
+
+template <typename T>
+struct return_count<const T> : return_count<T> {};
+
+template <typename T>
+struct return_count<T&> : return_count<T> {};
+
+template <typename T>
+struct return_count<T&&> : return_count<T> {};
+
+template <>
+struct return_count<void> {
+    static constexpr int value = 0;
+};
+
+template <typename... Ts>
+struct return_count<std::tuple<Ts...> > {
+    static constexpr int value = sizeof...(Ts);
+};
+
+template <typename T1, typename T2>
+struct return_count<std::pair<T1, T2> > {
+    static constexpr int value = 2;
+};
+
+/**
+  * \param 	t a Lua type (LUA_TNIL, LUA_TNUMBER, ...) or LUA_TNONE
+  * \return 	the bit of the type in the masks of lua_arg
+  * \author 	Stud
+  */
+constexpr unsigned int lua_type_bit(const int t)
+{
+    return 1u << (t + 1);
+}
+
+/**
+  * \author 	Stud
+  * \brief 	Describes the Lua values accepted for a parameter of type T.
+  *          mask is the set of accepted Lua types, check is only called
+  *          when the type is in the mask and looks at the value itself.
+  *          Default type is a registered class.
+  */
+template <typename T, typename Enable = void>
+struct lua_arg {
+    static constexpr unsigned int mask = lua_type_bit(LUA_TUSERDATA);
+
+    static bool check(lua_State *l, const int index) {
+        return l_checkClass<T>(l, index) != NULL;
+    }
+};
+
+/**
+  * \author 	Stud
+  * \brief 	Numbers (int, unsigned int, lua_Number, ...)
+  */
+template <typename T>
+struct lua_arg<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+    static constexpr unsigned int mask = lua_type_bit(LUA_TNUMBER);
+
+    static bool check(lua_State *, const int) {
+        return true;
+    }
+};
+
+/**
+  * \author 	Stud
+  * \brief 	Booleans
+  */
+template <>
+struct lua_arg<bool> {
+    static constexpr unsigned int mask = lua_type_bit(LUA_TBOOLEAN);
+
+    static bool check(lua_State *, const int) {
+        return true;
+    }
+};
+
+/**
+  * \author 	Stud
+  * \brief 	Strings, a number is not considered as a string to tell the
+  *          overloads apart.
+  */
+template <>
+struct lua_arg<std::string> {
+    static constexpr unsigned int mask = lua_type_bit(LUA_TSTRING);
+
+    static bool check(lua_State *, const int) {
+        return true;
+    }
+};
+
+template <>
+struct lua_arg<const char*> : lua_arg<std::string> {};
+
+#ifdef CPPLUA_HAS_STRING_VIEW
+template <>
+struct lua_arg<std::string_view> : lua_arg<std::string> {};
+#endif
+
+/**
+  * \author 	Stud
+  * \brief 	Lua functions used as callbacks
+  */
+template <typename Ret, typename... Args>
+struct lua_arg<std::function<Ret(Args...)> > {
+    static constexpr unsigned int mask = lua_type_bit(LUA_TFUNCTION);
+
+    static bool check(lua_State *, const int) {
+        return true;
+    }
+};
+
+/**
+  * \author 	Stud
+  * \brief 	Pointers, either a light userdata or a registered class
+  */
+template <typename T>
+struct lua_arg<T*, typename std::enable_if<!std::is_same<T, const char>::value>::type> {
+    static constexpr unsigned int mask = lua_type_bit(LUA_TUSERDATA) | lua_type_bit(LUA_TLIGHTUSERDATA);
+
+    static bool check(lua_State *l, const int index) {
+        return lua_islightuserdata(l, index) || l_checkClass<T>(l, index) != NULL;
+    }
+};
+
+/**
+  * \author 	Stud
+  * \brief 	Containers are read from tables
+  */
+struct lua_table_arg {
+    static constexpr unsigned int mask = lua_type_bit(LUA_TTABLE);
+
+    static bool check(lua_State *, const int) {
+        return true;
+    }
+};
+
+template <typename T, typename Alloc>
+struct lua_arg<std::vector<T, Alloc> > : lua_table_arg {};
+
+template <typename T, std::size_t N>
+struct lua_arg<std::array<T, N> > : lua_table_arg {};
+
+template <typename K, typename V, typename Compare, typename Alloc>
+struct lua_arg<std::map<K, V, Compare, Alloc> > : lua_table_arg {};
+
+template <typename K, typename V, typename Hash, typename Pred, typename Alloc>
+struct lua_arg<std::unordered_map<K, V, Hash, Pred, Alloc> > : lua_table_arg {};
+
+/**
+  * \author 	Stud
+  * \brief 	Smart pointers on registered classes, nil is an empty pointer
+  */
+template <typename T>
+struct lua_arg<std::shared_ptr<T> > {
+    static constexpr unsigned int mask = lua_type_bit(LUA_TUSERDATA) | lua_type_bit(LUA_TNIL) | lua_type_bit(LUA_TNONE);
+
+    static bool check(lua_State *l, const int index) {
+        ObjectHeader* header = toObjectHeader(l, index);
+        return lua_isnoneornil(l, index)
+                || (header != NULL && header->mode == ObjectHeader::SHARED && l_checkClass<T>(l, index) != NULL);
+    }
+};
+
+template <typename T, typename D>
+struct lua_arg<std::unique_ptr<T, D> > {
+    static constexpr unsigned int mask = lua_type_bit(LUA_TUSERDATA) | lua_type_bit(LUA_TNIL) | lua_type_bit(LUA_TNONE);
+
+    static bool check(lua_State *l, const int index) {
+        ObjectHeader* header = toObjectHeader(l, index);
+        return lua_isnoneornil(l, index)
+                || (header != NULL && header->mode == ObjectHeader::UNIQUE
+                    && header->info == &getClassInfo<typename std::remove_cv<T>::type>());
+    }
+};
+
+/**
+  * \author 	Stud
+  * \brief 	Optional parameters also accept nil or no value at all
+  */
+template <typename T>
+struct lua_arg<optional<T> > {
+    static constexpr unsigned int mask = lua_arg<T>::mask | lua_type_bit(LUA_TNIL) | lua_type_bit(LUA_TNONE);
+
+    static bool check(lua_State *l, const int index) {
+        return lua_isnoneornil(l, index) || lua_arg<T>::check(l, index);
+    }
+};
+
+/**
+  * \param 	l lua_State*
+  * \param 	index index on the stack
+  * \return 	true if the value at index can be read as a T
+  * \author 	Stud
+  */
+template <typename T>
+inline bool check_arg(lua_State *l, const int index)
+{
+    typedef typename std::decay<T>::type Type;
+    return (lua_type_bit(lua_type(l, index)) & lua_arg<Type>::mask) != 0
+            && lua_arg<Type>::check(l, index);
+}
+
 #endif
@@ -0,0 +1,448 @@
+#ifndef STATE_POOL_H
+#define STATE_POOL_H
+
+/**
+ * Copyright (c) 2014 Domora
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/** A pool of lua_States run by worker threads, one state per worker.
+ *
+ *  The states are built from the same StateRegistry: the list of the
+ *  modules (registerModule, the classes are registered by the loaders) and
+ *  of the scripts, replayed on each state. The states are all built by the
+ *  constructor of the pool, before the workers start: the registrations
+ *  write the ClassInfo of the classes, shared by every state, while the
+ *  jobs read it. A registration that fails makes the constructor throw.
+ *
+ *  A job is the name of a global Lua function and its arguments. It is
+ *  queued on one worker (round robin), a worker without job steals the
+ *  oldest jobs of the others. The result is given by a std::future.
+ *
+ *  Usage:
+ *      StateRegistry registry;
+ *      registry.module<load_module>("Module").script("function rule(x) ... end");
+ *      StatePool pool(registry, 4);
+ *      std::future<int> r = pool.submit<int>("rule", 42);
+ *
+ *  The arguments and the results are copied from one thread to the other,
+ *  they must not be Lua references (Table, std::function, ...). */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lua_register.h"
+
+/**
+ * \param 	l lua_State*
+ * \return 	the error object on top of the stack as a string, whatever its
+ *          type (error({}) gives "table: 0x...")
+ * \author 	Stud
+ */
+inline std::string luaErrorMessage(lua_State* l)
+{
+    std::size_t size = 0;
+    const char* message = luaL_tolstring(l, -1, &size);
+    std::string result(message, size);
+    lua_pop(l, 1);
+    return result;
+}
+
+/**
+ * \author 	Stud
+ * \brief 	The registrations replayed on every state of a pool.
+ */
+class StateRegistry
+{
+public:
+    /**
+     * \param 	name name of the module given to require
+     * \author 	Stud
+     * \brief 	Adds the module to the _PRELOAD table of the states.
+     */
+    template <int (*f)(lua_State*)>
+    StateRegistry& module(const char* name)
+    {
+        steps_.push_back([name](lua_State* l) {
+            luaL_getsubtable(l, LUA_REGISTRYINDEX, "_PRELOAD");
+            registerModule<f>(l, name);
+            lua_pop(l, 1);
+            return true;
+        });
+        return *this;
+    }
+
+    /**
+     * \param 	source Lua code run once on every state
+     * \author 	Stud
+     */
+    StateRegistry& script(std::string source)
+    {
+        steps_.push_back([source](lua_State* l) {
+            //The error message is left on the stack
+            return luaL_dostring(l, source.c_str()) == LUA_OK;
+        });
+        return *this;
+    }
+
+    /**
+     * \param 	f any other registration, called with each new state
+     * \author 	Stud
+     */
+    StateRegistry& step(std::function<void(lua_State*)> f)
+    {
+        steps_.push_back([f](lua_State* l) {
+            f(l);
+            return true;
+        });
+        return *this;
+    }
+
+    /**
+     * \param 	error filled with the error message if a step fails
+     * \return 	a new state with the standard libraries and the registrations,
+     *          NULL if a step fails
+     * \author 	Stud
+     * \brief 	The steps run in protected mode. The states are built one at
+     *          a time in the whole process, the registrations write the
+     *          ClassInfo shared by all the states.
+     */
+    lua_State* newstate(std::string* error = NULL) const
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        lua_State* l = luaL_newstate();
+        if(l == NULL)
+        {
+            if(error != NULL)
+                *error = "not enough memory to create the state";
+            return NULL;
+        }
+        luaL_openlibs(l);
+        for(std::size_t i = 0; i < steps_.size(); ++i)
+        {
+            lua_pushcfunction(l, &StateRegistry::run_step);
+            lua_pushlightuserdata(l, const_cast<Step*>(&steps_[i]));
+            if(lua_pcall(l, 1, 0, 0) != LUA_OK)
+            {
+                if(error != NULL)
+                    *error = luaErrorMessage(l);
+                lua_close(l);
+                return NULL;
+            }
+        }
+        return l;
+    }
+
+private:
+    typedef std::function<bool(lua_State*)> Step;
+
+    static std::mutex& mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+
+    /**
+     * \brief 	Runs the step given as light userdata, a step that returns
+     *          false leaves its error on top of the stack.
+     */
+    static int run_step(lua_State* l)
+    {
+        const Step& step = *static_cast<const Step*>(lua_touserdata(l, 1));
+        lua_pop(l, 1);
+        if(!step(l))
+            return lua_error(l);
+        return 0;
+    }
+
+    std::vector<Step> steps_;
+};
+
+/** The counters of a worker of the pool */
+struct WorkerStats
+{
+    WorkerStats() :
+        jobs(0),
+        finished(0),
+        stolen(0),
+        queue_depth(0),
+        total_latency(0),
+        max_latency(0)
+    {}
+
+    /**
+     * \return 	the mean time between the submission and the end of a job
+     * \author 	Stud
+     */
+    std::chrono::microseconds mean_latency() const
+    {
+        if(finished == 0)
+            return std::chrono::microseconds(0);
+        return total_latency / static_cast<long>(finished);
+    }
+
+    /** Jobs taken by the worker, stolen ones included */
+    std::size_t jobs;
+    /** Jobs whose latency is in total_latency */
+    std::size_t finished;
+    /** Jobs taken from the queue of another worker */
+    std::size_t stolen;
+    /** Jobs waiting in the queue of the worker */
+    std::size_t queue_depth;
+    std::chrono::microseconds total_latency;
+    std::chrono::microseconds max_latency;
+};
+
+class StatePool
+{
+public:
+    /**
+     * \param 	registry the registrations of the states, copied
+     * \param 	workers number of threads and states
+     * \author 	Stud
+     * \brief 	Throws a std::runtime_error if a state cannot be built.
+     */
+    StatePool(const StateRegistry& registry, std::size_t workers = std::thread::hardware_concurrency()) :
+        registry_(registry),
+        next_(0),
+        queued_(0),
+        stop_(false)
+    {
+        if(workers == 0)
+            workers = 1;
+        for(std::size_t i = 0; i < workers; ++i)
+        {
+            std::string error;
+            lua_State* l = registry_.newstate(&error);
+            if(l == NULL)
+            {
+                for(std::size_t j = 0; j < workers_.size(); ++j)
+                    lua_close(workers_[j]->state);
+                throw std::runtime_error("cannot build the state of a worker: " + error);
+            }
+            workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+            workers_.back()->state = l;
+        }
+        //No registration runs once the workers are started
+        for(std::size_t i = 0; i < workers; ++i)
+            workers_[i]->thread = std::thread(&StatePool::run, this, i);
+    }
+
+    /**
+     * \brief 	The jobs already submitted are run before the threads stop.
+     */
+    ~StatePool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for(std::size_t i = 0; i < workers_.size(); ++i)
+            workers_[i]->thread.join();
+    }
+
+    StatePool(const StatePool&) = delete;
+    StatePool& operator=(const StatePool&) = delete;
+
+    /**
+     * \param 	function name of the global Lua function
+     * \param 	args arguments of the function, copied
+     * \return 	the future of the first result of the function, it holds a
+     *          std::runtime_error if the function fails or if its result
+     *          cannot be read as a Ret
+     * \author 	Stud
+     */
+    template <typename Ret, typename... Args>
+    std::future<Ret> submit(std::string function, Args&&... args)
+    {
+        typedef std::tuple<typename std::decay<Args>::type...> Values;
+        auto promise = std::make_shared<std::promise<Ret> >();
+        std::future<Ret> result = promise->get_future();
+        Values values(std::forward<Args>(args)...);
+        enqueue([promise, function, values](lua_State* l) {
+            Call<Ret, Values> call = { &function, &values, promise.get() };
+            const int top = lua_gettop(l);
+            //Neither of these allocates, all the rest runs in protected mode
+            lua_CFunction f = &StatePool::call_function<Ret, Values>;
+            lua_pushcfunction(l, f);
+            lua_pushlightuserdata(l, &call);
+            if(lua_pcall(l, 1, 0, 0) != LUA_OK)
+                promise->set_exception(std::make_exception_ptr(std::runtime_error(luaErrorMessage(l))));
+            lua_settop(l, top);
+        });
+        return result;
+    }
+
+    std::size_t size() const
+    {
+        return workers_.size();
+    }
+
+    /**
+     * \param 	i index of the worker
+     * \return 	a copy of the counters of the worker
+     * \author 	Stud
+     */
+    WorkerStats stats(std::size_t i) const
+    {
+        Worker& worker = *workers_[i];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        WorkerStats stats = worker.stats;
+        stats.queue_depth = worker.jobs.size();
+        return stats;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job
+    {
+        std::function<void(lua_State*)> run;
+        Clock::time_point submitted;
+    };
+
+    struct Worker
+    {
+        mutable std::mutex mutex;
+        std::deque<Job> jobs;
+        WorkerStats stats;
+        std::thread thread;
+        lua_State* state;
+    };
+
+    template <typename Ret>
+    static void set_result(std::promise<Ret>& promise, lua_State* l)
+    {
+        promise.set_value(read<Ret>(l, -1));
+    }
+
+    static void set_result(std::promise<void>& promise, lua_State*)
+    {
+        promise.set_value();
+    }
+
+    /** A job of submit, given to call_function as a light userdata */
+    template <typename Ret, typename Values>
+    struct Call
+    {
+        const std::string* function;
+        const Values* values;
+        std::promise<Ret>* promise;
+    };
+
+    /**
+     * \brief 	Called in protected mode with the Call: pushes the function
+     *          and its arguments, calls it and reads its result. Pushing a
+     *          class not registered in the state or reading a result of the
+     *          wrong type raises a Lua error, not a panic.
+     */
+    template <typename Ret, typename Values>
+    static int call_function(lua_State* l)
+    {
+        const Call<Ret, Values>* call = static_cast<const Call<Ret, Values>*>(lua_touserdata(l, 1));
+        lua_getglobal(l, call->function->c_str());
+        _push(l, *call->values);
+        lua_call(l, std::tuple_size<Values>::value, 1);
+        set_result(*call->promise, l);
+        return 0;
+    }
+
+    void enqueue(std::function<void(lua_State*)> f)
+    {
+        Worker& worker = *workers_[next_.fetch_add(1, std::memory_order_relaxed) % workers_.size()];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.jobs.push_back(Job{std::move(f), Clock::now()});
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            ++queued_;
+        }
+        wake_.notify_one();
+    }
+
+    /**
+     * \param 	i index of the worker
+     * \param 	job filled with the job found
+     * \param 	stolen set to true if the job comes from another queue
+     * \return 	false if no queue has a job
+     * \brief 	The worker takes the oldest job of its queue, or steals the
+     *          oldest job of the next queue that has one.
+     */
+    bool take(std::size_t i, Job& job, bool& stolen)
+    {
+        for(std::size_t n = 0; n < workers_.size(); ++n)
+        {
+            Worker& victim = *workers_[(i + n) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(victim.jobs.empty())
+                continue;
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            stolen = n != 0;
+            std::lock_guard<std::mutex> wake_lock(wake_mutex_);
+            --queued_;
+            return true;
+        }
+        return false;
+    }
+
+    void run(std::size_t i)
+    {
+        Worker& worker = *workers_[i];
+        lua_State* l = worker.state;
+        for(;;)
+        {
+            Job job;
+            bool stolen = false;
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex_);
+                wake_.wait(lock, [this]() { return queued_ > 0 || stop_; });
+                if(queued_ == 0 && stop_)
+                    break;
+            }
+            //Another worker may have taken the job in the meantime
+            if(!take(i, job, stolen))
+                continue;
+            {
+                //Counted before the result is given to the future
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                ++worker.stats.jobs;
+                if(stolen)
+                    ++worker.stats.stolen;
+            }
+            job.run(l);
+            const std::chrono::microseconds latency =
+                    std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - job.submitted);
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            ++worker.stats.finished;
+            worker.stats.total_latency += latency;
+            if(latency > worker.stats.max_latency)
+                worker.stats.max_latency = latency;
+        }
+        lua_close(l);
+    }
+
+    const StateRegistry registry_;
+    std::vector<std::unique_ptr<Worker> > workers_;
+    std::atomic<std::size_t> next_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::size_t queued_;
+    bool stop_;
+};
+
+#endif
@@ -16,6 +16,62 @@ inline Table::TablePair::TablePair(std::string key, Table &table):
 }
 
 
+inline TablePath::TablePath(lua_State *l, const std::string &path):
+    l_state_(l),
+    size_(0)
+{
+    lua_newtable(l_state_);
+    std::size_t begin = 0;
+    for(;;)
+    {
+        std::size_t found = path.find('.', begin);
+        std::size_t end = found == std::string::npos ? path.size() : found;
+        lua_pushlstring(l_state_, path.data() + begin, end - begin);
+        lua_rawseti(l_state_, -2, ++size_);
+        if(found == std::string::npos)
+            break;
+        begin = found + 1;
+    }
+    ref_ = luaL_ref(l_state_, LUA_REGISTRYINDEX);
+}
+
+inline TablePath::TablePath(const TablePath &p):
+    l_state_(p.l_state_),
+    size_(p.size_)
+{
+    //The keys never change, the copies share them
+    p.load_keys(l_state_);
+    ref_ = luaL_ref(l_state_, LUA_REGISTRYINDEX);
+}
+
+inline TablePath &TablePath::operator=(const TablePath &p)
+{
+    if(this != &p)
+    {
+        luaL_unref(l_state_, LUA_REGISTRYINDEX, ref_);
+        l_state_ = p.l_state_;
+        size_ = p.size_;
+        p.load_keys(l_state_);
+        ref_ = luaL_ref(l_state_, LUA_REGISTRYINDEX);
+    }
+    return *this;
+}
+
+inline TablePath::~TablePath()
+{
+    luaL_unref(l_state_, LUA_REGISTRYINDEX, ref_);
+}
+
+inline int TablePath::get_size() const
+{
+    return size_;
+}
+
+inline void TablePath::load_keys(lua_State* l) const
+{
+    lua_rawgeti(l, LUA_REGISTRYINDEX, ref_);
+}
+
 inline Table::Table(lua_State *l, bool use_stack):
     name_(""),
     l_state_(l),
@@ -159,6 +215,63 @@ inline U Table::get(const std::string& key)
     }
 }
 
+template<typename U>
+inline U Table::get(const TablePath& path)
+{
+    path.load_keys(l_state_);
+    const int keys = lua_gettop(l_state_);
+    load_table();
+    luaL_checktype(l_state_, -1, LUA_TTABLE);
+    for(int i = 1; i <= path.get_size(); ++i)
+    {
+        //A missing nested table reads as nil
+        if(!lua_istable(l_state_, -1))
+        {
+            lua_pop(l_state_, 1);
+            lua_pushnil(l_state_);
+            break;
+        }
+        lua_rawgeti(l_state_, keys, i);
+        lua_rawget(l_state_, -2);
+        lua_remove(l_state_, -2);
+    }
+    U u = read<U>(l_state_, -1);
+    lua_settop(l_state_, keys - 1);
+    return u;
+}
+
+template<typename T>
+inline void Table::set(const TablePath& path, T value)
+{
+    path.load_keys(l_state_);
+    const int keys = lua_gettop(l_state_);
+    load_table();
+    luaL_checktype(l_state_, -1, LUA_TTABLE);
+    for(int i = 1; i < path.get_size(); ++i)
+    {
+        lua_rawgeti(l_state_, keys, i);
+        lua_pushvalue(l_state_, -1);
+        lua_rawget(l_state_, -3);
+        if(lua_isnil(l_state_, -1))
+        {
+            //Add the missing nested table
+            lua_pop(l_state_, 1);
+            lua_newtable(l_state_);
+            lua_pushvalue(l_state_, -2);
+            lua_pushvalue(l_state_, -2);
+            lua_rawset(l_state_, -5);
+        }
+        else if(!lua_istable(l_state_, -1))
+            luaL_error(l_state_, "%s is not a table", lua_tostring(l_state_, -2));
+        lua_remove(l_state_, -2);
+        lua_remove(l_state_, -2);
+    }
+    lua_rawgeti(l_state_, keys, path.get_size());
+    push(l_state_, value);
+    lua_rawset(l_state_, -3);
+    lua_settop(l_state_, keys - 1);
+}
+
 template<typename U>
 inline U Table::get(const int key)
 {
@@ -331,8 +444,7 @@ inline void Table::copy_value()
   * \param 	t Table
   * \brief 	Push a table on the Lua stack
   */
-template <>
-inline void _push<Table>(lua_State *, Table t) {
+inline void _push(lua_State *, const Table& t) {
     t.load_table();
 }
 
@@ -20,6 +20,45 @@ extern "C" {
 
 #include "read_and_write.h"
 
+/** A path into nested tables ("a.b.c") split once. The keys are Lua
+ *  strings kept in a table of the registry, so Table::get and Table::set
+ *  walk the path with lua_rawget without building any string. The path
+ *  must not outlive its lua_State.
+ *  */
+ class TablePath
+ {
+  public:
+
+     /**
+      * \param 	l lua_State*
+      * \param 	path the keys separated by "."
+      * \author 	Stud
+      */
+     TablePath(lua_State* l, const std::string& path);
+
+     TablePath(const TablePath& p);
+
+     TablePath& operator=(const TablePath& p);
+
+     ~TablePath();
+
+     /** Number of keys in the path */
+     int get_size() const;
+
+     /**
+      * \param 	l a thread of the state of the path
+      * \author 	Stud
+      * \brief 	Push the array of the keys of the path on the stack of l.
+      */
+     void load_keys(lua_State* l) const;
+
+  private:
+
+     lua_State* l_state_;
+     int ref_;
+     int size_;
+ };
+
  class Table
  {
   public:    
@@ -61,6 +100,25 @@ extern "C" {
      template<typename U>
      U get(const std::string& key);
 
+     /**
+      * \param 	path the path of the value in the nested tables.
+      * \author 	Stud
+      * \brief 	Same as get(const std::string&) with a path split once,
+      *          the tables are read with lua_rawget.
+      */
+     template<typename U>
+     U get(const TablePath& path);
+
+     /**
+      * \param 	path the path of the value in the nested tables.
+      * \param 	value value to write.
+      * \author 	Stud
+      * \brief 	Same as set(const std::string&, T) with a path split once,
+      *          the missing nested tables are added.
+      */
+     template<typename T>
+     void set(const TablePath& path, T value);
+
      /**
       * \param 	key index of the value in the current table.
       * \author 	Stud
@@ -164,5 +222,25 @@ extern "C" {
      bool global_;
  };
 
+ /**
+  * \brief 	A Table is a handle on a Lua table, it is read by value
+  */
+template <>
+struct is_primitive<Table> {
+    static constexpr bool value = true;
+};
+
+ /**
+  * \brief 	A Table parameter accepts a Lua table
+  */
+template <>
+struct lua_arg<Table> {
+    static constexpr unsigned int mask = lua_type_bit(LUA_TTABLE);
+
+    static bool check(lua_State *, const int) {
+        return true;
+    }
+};
+
 #include "table.tpp"
 #endif
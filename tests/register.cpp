@@ -10,9 +10,23 @@ extern "C" {
 #include <sstream>
 #include <algorithm>
 #include <functional>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <array>
+#include <map>
+#include <unordered_map>
 
 #include "table.h"
 #include "lua_register.h"
+#include "buffer.h"
+#include "allocator.h"
+#include "dispatcher.h"
+#include "async.h"
+#include "state_pool.h"
+#include "bytecode_cache.h"
+#include "profiler.h"
 
 //Load LUA_C API
 static const luaL_Reg loadedlibs[] = {
@@ -38,6 +52,7 @@ A bunch of methods and variables to tests the values after the test.
 */
 int index_constructor, void_CFunction, void_CFunctionA, void_CFuncParam, c_table_param, table_param, table_param_ref;
 int parent_count, derive_count, parent_module_count, derive_module_count, read_on_lua_value, register_optional_int;
+int deep_count;
 std::string name_constructor, name_empty_constructor;
 bool destructor_called = false;
 lua_State * l_;
@@ -128,6 +143,167 @@ public:
     }
 };
 
+class Left
+{
+public:
+    Left(): left(1) {}
+
+    int get_left()
+    {
+        return left;
+    }
+
+    int left;
+};
+
+class Right
+{
+public:
+    Right(): right(2) {}
+
+    int get_right()
+    {
+        return right;
+    }
+
+    int right;
+};
+
+class Both : public Left, public Right
+{
+public:
+    Both() {}
+};
+
+//A vptr added in front of a base that has none
+class Tagged : public Right
+{
+public:
+    Tagged() {}
+    virtual ~Tagged() {}
+
+    virtual int tag()
+    {
+        return 4;
+    }
+};
+
+int read_right(Right& r)
+{
+    return r.right;
+}
+
+std::vector<std::function<void(int)> > handlers;
+int handler_total = 0;
+
+void add_handler(std::function<void(int)> f)
+{
+    handlers.push_back(f);
+}
+
+void post_from_thread(PostedFunction<void(int)> f)
+{
+    std::thread t([f]() { f(7); });
+    t.join();
+}
+
+std::future<int> delayed_double(int value)
+{
+    return std::async(std::launch::async, [value]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return value * 2;
+    });
+}
+
+std::future<int> failed_double(int value)
+{
+    //Not a std::exception
+    return std::async(std::launch::async, [value]() -> int { throw value; });
+}
+
+void reply_later(Completion<std::string> done, std::string request)
+{
+    std::thread([done, request]() { done("reply to " + request); }).detach();
+}
+
+Right make_right(int value)
+{
+    Right r;
+    r.right = value;
+    return r;
+}
+
+Right borrowed_right;
+
+Right* borrow_right()
+{
+    return &borrowed_right;
+}
+
+std::shared_ptr<Right> shared_right = std::make_shared<Right>();
+
+std::shared_ptr<Right> share_right()
+{
+    return shared_right;
+}
+
+int count_shared(std::shared_ptr<Right> r)
+{
+    return r.use_count();
+}
+
+std::unique_ptr<Right> own_right(int value)
+{
+    std::unique_ptr<Right> r(new Right());
+    r->right = value;
+    return r;
+}
+
+int take_right(std::unique_ptr<Right> r)
+{
+    return r->right;
+}
+
+lua_Number buffer_first(Buffer<double>& b)
+{
+    return b[0];
+}
+
+namespace ns1
+{
+class Twin
+{
+public:
+    int value()
+    {
+        return 1;
+    }
+};
+}
+
+namespace ns2
+{
+class Twin
+{
+public:
+    int value()
+    {
+        return 2;
+    }
+};
+}
+
+class DeriveDeep : public Derive
+{
+public:
+    DeriveDeep() {}
+
+    void countDeep()
+    {
+        deep_count = 3;
+    }
+};
+
 class DeriveModule : public BaseModule
 {
 public:
@@ -209,6 +385,58 @@ public:
         return _index;
     }
 
+    const std::string& get_name_ref()
+    {
+        return _name;
+    }
+
+    std::tuple<std::string, int, bool> get_all()
+    {
+        return std::make_tuple(_name, _index, true);
+    }
+
+    std::pair<int, int> get_min_max(int a, int b)
+    {
+        return std::make_pair(std::min(a, b), std::max(a, b));
+    }
+
+    int sum_vector(const std::vector<int>& v)
+    {
+        int sum = 0;
+        for(int i : v)
+            sum += i;
+        return sum;
+    }
+
+    std::vector<int> range(int n)
+    {
+        std::vector<int> v;
+        for(int i = 1; i <= n; ++i)
+            v.push_back(i);
+        return v;
+    }
+
+    int sum_array(std::array<int, 3> a)
+    {
+        return a[0] + a[1] + a[2];
+    }
+
+    std::map<std::string, int> count_words(std::unordered_map<std::string, int> words)
+    {
+        return std::map<std::string, int>(words.begin(), words.end());
+    }
+
+    int c_string_length(const char* s)
+    {
+        return strlen(s);
+    }
+
+#ifdef CPPLUA_HAS_STRING_VIEW
+    int string_view_length(std::string_view s)
+    {
+        return s.size();
+    }
+#endif
 
     int call_func(std::function<int()> f)
     {
@@ -265,6 +493,42 @@ private:
 };
 
 
+class Overloaded
+{
+public:
+    Overloaded() {}
+
+    int set(int)
+    {
+        return 1;
+    }
+
+    int set(std::string)
+    {
+        return 2;
+    }
+
+    int set(int, int)
+    {
+        return 3;
+    }
+
+    int set(Class&)
+    {
+        return 4;
+    }
+
+    static int make(int)
+    {
+        return 1;
+    }
+
+    static int make(optional<std::string>)
+    {
+        return 2;
+    }
+};
+
 class ClassEmpty
 {
 public:
@@ -330,7 +594,7 @@ int load_base_two(lua_State* l)
 {
 	METHOD(BaseModule::countBase)::push(l, "countBase");
 	//Macro that register a public attribute
-    registerAttribute<int, BaseModule, &BaseModule::ten>(l_, "a");
+    registerAttribute<int, BaseModule, &BaseModule::ten>(l, "a");
     return 0;
 }
 
@@ -340,6 +604,51 @@ int load_derive(lua_State* l)
     return 0;
 }
 
+int load_derive_deep(lua_State* l)
+{
+    METHOD(DeriveDeep::countDeep)::push(l, "countDeep");
+    return 0;
+}
+
+int load_left(lua_State* l)
+{
+    METHOD(Left::get_left)::push(l, "get_left");
+    return 0;
+}
+
+int load_right(lua_State* l)
+{
+    METHOD(Right::get_right)::push(l, "get_right");
+    registerAttribute<int, Right, &Right::right>(l, "right");
+    return 0;
+}
+
+int load_both(lua_State* l)
+{
+    //Declare the C++ bases so that the pointers are adjusted
+    registerParent<Both, Left>(l, "Left");
+    registerParent<Both, Right>(l, "Right");
+    return 0;
+}
+
+int load_tagged(lua_State* l)
+{
+    METHOD(Tagged::tag)::push(l, "tag");
+    return 0;
+}
+
+int load_twin_one(lua_State* l)
+{
+    METHOD(ns1::Twin::value)::push(l, "value");
+    return 0;
+}
+
+int load_twin_two(lua_State* l)
+{
+    METHOD(ns2::Twin::value)::push(l, "value");
+    return 0;
+}
+
 int load_derive_two(lua_State* l)
 {
     METHOD(DeriveModule::countDerive)::push(l, "countDerive");
@@ -356,11 +665,42 @@ int load_Class(lua_State* l)
     METHOD(Class::add)::push(l, "add");
     METHOD(Class::get_name)::push(l, "get_name");
     METHOD(Class::get_index)::push(l, "get_index");
+    METHOD(Class::get_name_ref)::push(l, "get_name_ref");
+    METHOD(Class::get_all)::push(l, "get_all");
+    METHOD(Class::get_min_max)::push(l, "get_min_max");
+    METHOD(Class::sum_vector)::push(l, "sum_vector");
+    METHOD(Class::range)::push(l, "range");
+    METHOD(Class::sum_array)::push(l, "sum_array");
+    METHOD(Class::count_words)::push(l, "count_words");
+    METHOD(Class::c_string_length)::push(l, "c_string_length");
+#ifdef CPPLUA_HAS_STRING_VIEW
+    METHOD(Class::string_view_length)::push(l, "string_view_length");
+#endif
     METHOD(Class::ret_table)::push(l, "ret_table");
     METHOD(Class::return_to_lua)::push(l, "return_to_lua");
     METHOD(Class::read_on_lua)::push(l, "read_on_lua");
     METHOD(Class::register_optional)::push(l, "register_optional");
     registerAttribute<int, Class, &Class::ten>(l_, "a");
+    //Member function pointer only known at runtime
+    int (Class::*index_getter)() = &Class::get_index;
+    registerMemberPointer(l, "get_index_runtime", index_getter);
+    return 0;
+}
+
+int load_Overloaded(lua_State* l)
+{
+    //Several member functions under the same name
+    METHODS(OVERLOAD(int (Overloaded::*)(int), Overloaded::set),
+            OVERLOAD(int (Overloaded::*)(std::string), Overloaded::set),
+            OVERLOAD(int (Overloaded::*)(int, int), Overloaded::set),
+            OVERLOAD(int (Overloaded::*)(Class&), Overloaded::set))::push(l, "set");
+    return 0;
+}
+
+int load_static_Overloaded(lua_State* l)
+{
+    STATICMETHODS(STATICOVERLOAD(int (*)(int), Overloaded::make),
+                  STATICOVERLOAD(int (*)(optional<std::string>), Overloaded::make))::push(l, "make");
     return 0;
 }
 
@@ -390,6 +730,17 @@ int load_S_Class(lua_State* l)
     return 0;
 }
 
+//Registration tables, filled at compile time
+constexpr luaL_Reg static_class_methods[] = {
+    {"sum", METHOD(StaticClass::sum)::call}
+};
+
+constexpr luaL_Reg static_class_statics[] = {
+    {"get_ten", STATICMETHOD(StaticClass::get_ten)::call},
+    {"static_sum", STATICMETHOD(StaticClass::static_sum)::call},
+    {"static_table", STATICMETHOD(StaticClass::static_table)::call}
+};
+
 /*
 #############################################
 The functions that register the classes into modules (This allows the user to load modules in Lua like NodeJS modules)
@@ -400,10 +751,18 @@ int load_module(lua_State* l)
 	//Function that register classes
     registerClass<Class, std::string, int>(l, load_Class,"Class");
     registerClass<ClassEmpty>(l, load_EmptyClass,"ClassEmpty");
-    registerClass<StaticClass>(l, load_S_Class, load_StaticClass, "StaticClass");
+    registerClass<StaticClass>(l, static_class_methods, static_class_statics, "StaticClass");
     registerClass<Base>(l, load_base, "Base");
-    registerClassInherit<Derive>(l, load_derive, "Derive", "Base");
-	registerClassInherit<DeriveModule>(l, load_derive_two, "DeriveModule", "Module2.BaseModule");
+    registerClassInherit<Derive, Base>(l, load_derive, "Derive", "Base");
+    registerClassInherit<DeriveDeep, Derive>(l, load_derive_deep, "DeriveDeep", "Derive");
+	registerClassInherit<DeriveModule, BaseModule>(l, load_derive_two, "DeriveModule", "Module2.BaseModule");
+    registerClass<Overloaded>(l, load_Overloaded, load_static_Overloaded, "Overloaded");
+    registerClass<Left>(l, load_left, "Left");
+    registerClass<Right>(l, load_right, "Right");
+    registerClass<Both>(l, load_both, "Both");
+    registerClassInherit<Tagged, Right>(l, load_tagged, "Tagged", "Right");
+    registerClass<ns1::Twin>(l, load_twin_one, "TwinOne");
+    registerClass<ns2::Twin>(l, load_twin_two, "TwinTwo");
 	//Macro that register a function into the module (C function available after the module is loaded in lua)
     MODULEFUNCTION(test_void_CFuncParam)::push(l_, "test_void_CFuncParam");
     MODULEFUNCTION(test_CFunctionA)::push(l_, "test_CFunctionA");
@@ -411,6 +770,47 @@ int load_module(lua_State* l)
     MODULEFUNCTION(test_void_CFunctionA)::push(l_, "test_void_CFunctionA");
     MODULEFUNCTION(test_void_CFunction)::push(l_, "test_void_CFunction");
     MODULEFUNCTION(Cfunc_with_table)::push(l_, "Cfunc_with_table");
+    MODULEFUNCTION(read_right)::push(l_, "read_right");
+    MODULEFUNCTION(buffer_first)::push(l_, "buffer_first");
+    MODULEFUNCTION(add_handler)::push(l_, "add_handler");
+    MODULEFUNCTION(post_from_thread)::push(l_, "post_from_thread");
+    MODULEFUNCTION(make_right)::push(l_, "make_right");
+    MODULEFUNCTION(borrow_right)::push(l_, "borrow_right");
+    MODULEFUNCTION(share_right)::push(l_, "share_right");
+    MODULEFUNCTION(count_shared)::push(l_, "count_shared");
+    MODULEFUNCTION(own_right)::push(l_, "own_right");
+    MODULEFUNCTION(take_right)::push(l_, "take_right");
+    ASYNCFUNCTION(delayed_double)::push(l_, "delayed_double");
+    ASYNCFUNCTION(failed_double)::push(l_, "failed_double");
+    ASYNCFUNCTION(reply_later)::push(l_, "reply_later");
+    registerBuffer<double>(l, "DoubleBuffer");
+    registerBuffer<float>(l, "FloatBuffer");
+    registerBuffer<int32_t>(l, "IntBuffer");
+    //Callable objects with a state, stored in the closure
+    int offset = 5;
+    registerFunctor(l, "add_offset", [offset](int a) { return a + offset; });
+    std::string prefix = "Hello ";
+    registerModuleFunctor(l, "greet", [prefix](const std::string& name) { return prefix + name; });
+}
+
+int load_module_lazy(lua_State* l)
+{
+    //Classes built on first use
+    registerLazyClass<Base>(l, load_base, "Base");
+    registerLazyClassInherit<Derive, Base>(l, load_derive, "Derive", "Base");
+    registerLazyClass<StaticClass>(l, load_S_Class, load_StaticClass, "StaticClass");
+    return 0;
+}
+
+int load_pool_classes(lua_State* l)
+{
+    //Inherited classes registered on every state of a pool
+    registerClass<Base>(l, load_base, "Base");
+    registerClassInherit<Derive, Base>(l, load_derive, "Derive", "Base");
+    registerClass<Left>(l, load_left, "Left");
+    registerClass<Right>(l, load_right, "Right");
+    registerClass<Both>(l, load_both, "Both");
+    return 0;
 }
 
 int load_module_two(lua_State* l)
@@ -438,6 +838,16 @@ LUALIB_API void openlib (lua_State *l) {
 
 	//Function that register the module
     registerModule<load_module_two>(l, "Module2");
+    registerModule<load_dispatcher>(l, "Dispatcher");
+    registerModule<load_async>(l, "Async");
+    registerModule<load_module_lazy>(l, "Lazy");
+    registerModule<load_profiler>(l, "Profiler");
+#ifdef CPPLUA_ENABLE_STATS
+    registerModule<load_call_stats>(l, "Stats");
+#endif
+#ifdef CPPLUA_ENABLE_INSTANCE_STATS
+    registerModule<load_instance_stats>(l, "Instances");
+#endif
     registerModule<load_module>(l, "Module");
 
     lua_pop(l, 1);  /* remove _PRELOAD table */
@@ -471,11 +881,15 @@ TEST_F(RegisterTest, register_class_with_static)
     luaL_dostring(l_, "Module = require(\"Module\")");
     luaL_dostring(l_, "test = Module.StaticClass.get_ten()");
     luaL_dostring(l_, "test2 = Module.StaticClass.static_sum(3, 5)");
+    //The class is registered with registration tables
+    luaL_dostring(l_, "test3 = Module.StaticClass():sum(1, 2)");
     lua_getglobal(l_, "test");
     lua_getglobal(l_, "test2");
+    lua_getglobal(l_, "test3");
 
     ASSERT_EQ(10, read<int>(l_, 1));
     ASSERT_EQ(8, read<int>(l_, 2));
+    ASSERT_EQ(3, read<int>(l_, 3));
 }
 
 TEST_F(RegisterTest, return_nonvoid_empty_param)
@@ -505,6 +919,144 @@ TEST_F(RegisterTest, return_nonvoid_variadic_param)
     ASSERT_EQ(std::string("Dummy"), read<std::string>(l_, 2));
 }
 
+TEST_F(RegisterTest, method_wrong_self)
+{
+    //A method called with "." or on another object raises an error
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "class = Module.Class(\"Dummy\", 10)");
+    luaL_dostring(l_, "ok1 = pcall(function() return class.get_name() end)");
+    luaL_dostring(l_, "ok2 = pcall(function() return class.get_index({}) end)");
+    luaL_dostring(l_, "ok3 = pcall(function() return class.return_to_lua(1) end)");
+    luaL_dostring(l_, "ok4 = pcall(function() return class.get_index_runtime(\"Dummy\") end)");
+    luaL_dostring(l_, "ok5 = pcall(function() return class.get_index() end)");
+    luaL_dostring(l_, "test = class:get_index()");
+
+    lua_getglobal(l_, "ok1");
+    lua_getglobal(l_, "ok2");
+    lua_getglobal(l_, "ok3");
+    lua_getglobal(l_, "ok4");
+    lua_getglobal(l_, "ok5");
+    lua_getglobal(l_, "test");
+
+    ASSERT_FALSE(read<bool>(l_, 1));
+    ASSERT_FALSE(read<bool>(l_, 2));
+    ASSERT_FALSE(read<bool>(l_, 3));
+    ASSERT_FALSE(read<bool>(l_, 4));
+    ASSERT_FALSE(read<bool>(l_, 5));
+    ASSERT_EQ(10, read<int>(l_, 6));
+}
+
+TEST_F(RegisterTest, string_without_copy)
+{
+    //Test the strings read and returned without copy
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "class = Module.Class(\"Dummy\", 10)");
+    luaL_dostring(l_, "test = class:get_name_ref()");
+    luaL_dostring(l_, "test2 = class:c_string_length(\"hello\")");
+
+    lua_getglobal(l_, "test");
+    lua_getglobal(l_, "test2");
+
+    ASSERT_EQ(std::string("Dummy"), read<std::string>(l_, 1));
+    ASSERT_EQ(5, read<int>(l_, 2));
+#ifdef CPPLUA_HAS_STRING_VIEW
+    luaL_dostring(l_, "test3 = class:string_view_length(\"hello world\")");
+    lua_getglobal(l_, "test3");
+    ASSERT_EQ(11, read<int>(l_, 3));
+#endif
+}
+
+TEST_F(RegisterTest, multiple_returns)
+{
+    //Test the tuples and pairs returned as several values
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "class = Module.Class(\"Dummy\", 10)");
+    luaL_dostring(l_, "a, b, c = class:get_all()");
+    luaL_dostring(l_, "d, e = class:get_min_max(7, 3)");
+    luaL_dostring(l_, "f = select(\"#\", class:add(1, 2))");
+
+    lua_getglobal(l_, "a");
+    lua_getglobal(l_, "b");
+    lua_getglobal(l_, "c");
+    lua_getglobal(l_, "d");
+    lua_getglobal(l_, "e");
+    lua_getglobal(l_, "f");
+    ASSERT_EQ(std::string("Dummy"), read<std::string>(l_, 1));
+    ASSERT_EQ(10, read<int>(l_, 2));
+    ASSERT_TRUE(read<bool>(l_, 3));
+    ASSERT_EQ(3, read<int>(l_, 4));
+    ASSERT_EQ(7, read<int>(l_, 5));
+    ASSERT_EQ(0, read<int>(l_, 6));
+}
+
+TEST_F(RegisterTest, containers)
+{
+    //Test the conversions between tables and standard containers
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "class = Module.Class(\"Dummy\", 10)");
+    luaL_dostring(l_, "a = class:sum_vector({1, 2, 3, 4})");
+    luaL_dostring(l_, "r = class:range(5) b = #r + r[5]");
+    luaL_dostring(l_, "c = class:sum_array({4, 5, 6, 7})");
+    luaL_dostring(l_, "w = class:count_words({foo = 2, bar = 3}) d = w.foo * w.bar");
+    //A value that is not a table is an error
+    luaL_dostring(l_, "e = pcall(class.sum_vector, class, 5) or pcall(class.count_words, class, nil)");
+
+    lua_getglobal(l_, "a");
+    lua_getglobal(l_, "b");
+    lua_getglobal(l_, "c");
+    lua_getglobal(l_, "d");
+    ASSERT_EQ(10, read<int>(l_, 1));
+    ASSERT_EQ(10, read<int>(l_, 2));
+    ASSERT_EQ(15, read<int>(l_, 3));
+    ASSERT_EQ(6, read<int>(l_, 4));
+    lua_getglobal(l_, "e");
+    ASSERT_FALSE(read<bool>(l_, 5));
+}
+
+TEST_F(RegisterTest, buffer)
+{
+    //Test the numeric buffers and their kernels
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "b = Module.DoubleBuffer(20)");
+    luaL_dostring(l_, "for i = 1, #b do b[i] = i end");
+    luaL_dostring(l_, "x = Module.DoubleBuffer(20) x:assign({1, 1, 1})");
+    luaL_dostring(l_, "b:axpy(2, x)");
+    luaL_dostring(l_, "a = b:sum() c = b:max() d = b:count_above(10) e = b[3] f = Module.buffer_first(nil, b)");
+    luaL_dostring(l_, "h = Module.FloatBuffer(3) h[2] = 4 h:scale(0.5) g = h:mean()");
+
+    lua_getglobal(l_, "a");
+    lua_getglobal(l_, "c");
+    lua_getglobal(l_, "d");
+    lua_getglobal(l_, "e");
+    lua_getglobal(l_, "f");
+    lua_getglobal(l_, "g");
+    ASSERT_EQ(216, read<int>(l_, 1));
+    ASSERT_EQ(20, read<int>(l_, 2));
+    ASSERT_EQ(10, read<int>(l_, 3));
+    ASSERT_EQ(5, read<int>(l_, 4));
+    ASSERT_EQ(3, read<int>(l_, 5));
+    ASSERT_DOUBLE_EQ(2.0 / 3, read<lua_Number>(l_, 6));
+
+    //The sum of int32 values larger than an int32
+    luaL_dostring(l_, "n = Module.IntBuffer(20) for i = 1, #n do n[i] = 2000000000 end s = n:sum() m = n:mean()");
+    lua_getglobal(l_, "s");
+    lua_getglobal(l_, "m");
+    ASSERT_DOUBLE_EQ(40000000000.0, read<lua_Number>(l_, 7));
+    ASSERT_DOUBLE_EQ(2000000000.0, read<lua_Number>(l_, 8));
+
+    //The factors and thresholds of an int32 buffer are not truncated first
+    luaL_dostring(l_, "k = Module.IntBuffer(3) k:assign({4, -2, 6}) k:scale(0.5)");
+    luaL_dostring(l_, "y = Module.IntBuffer(3) y:axpy(0.5, k) p = y[1] + y[3] q = k:count_above(-1.5)");
+    //Buffers of different sizes are an error
+    luaL_dostring(l_, "r = pcall(y.axpy, y, 1, Module.IntBuffer(2))");
+    lua_getglobal(l_, "p");
+    lua_getglobal(l_, "q");
+    lua_getglobal(l_, "r");
+    ASSERT_EQ(2, read<int>(l_, 9));
+    ASSERT_EQ(3, read<int>(l_, 10));
+    ASSERT_FALSE(read<bool>(l_, 11));
+}
+
 TEST_F(RegisterTest, return_void_variadic_param)
 { 
     //Test function that return void and take several argument
@@ -574,6 +1126,176 @@ TEST_F(RegisterTest, Function_pointer_parameter)
     ASSERT_EQ(5, void_CFuncParam);
 }
 
+TEST_F(RegisterTest, stored_callbacks)
+{
+    //Test the callbacks kept by C++ and called later
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "class = Module.Class(\"Dummy\", 10)");
+    luaL_dostring(l_, "total = 0 function handler(this, a) total = total + a end");
+    luaL_dostring(l_, "for i = 1, 3 do Module.add_handler(nil, handler) end");
+    luaL_dostring(l_, "ok = pcall(class.call_func, class, function() error(\"boom\") end)");
+    //An optional callback not given is kept as nil, calling it is an error
+    luaL_dostring(l_, "Module.add_handler(nil, nil)");
+    luaL_dostring(l_, "ok_nil = pcall(class.call_func, class, nil)");
+    luaL_dostring(l_, "Module.add_handler(nil)");
+
+    //The stack of the caller is kept
+    lua_pushinteger(l_, 42);
+    for(std::size_t i = 0; i < handlers.size(); ++i)
+        handlers[i](2);
+    ASSERT_EQ(1, lua_gettop(l_));
+    ASSERT_EQ(42, read<int>(l_, 1));
+    handlers.clear();
+
+    lua_getglobal(l_, "total");
+    lua_getglobal(l_, "ok");
+    ASSERT_EQ(6, read<int>(l_, 2));
+    ASSERT_FALSE(read<bool>(l_, 3));
+    lua_getglobal(l_, "ok_nil");
+    ASSERT_FALSE(read<bool>(l_, 4));
+}
+
+TEST_F(RegisterTest, posted_callbacks)
+{
+    //Test a callback called from another thread, it runs on drain
+    luaL_dostring(l_, "Module = require(\"Module\") Dispatcher = require(\"Dispatcher\")");
+    luaL_dostring(l_, "a = 0 Module.post_from_thread(nil, function(this, v) a = v end)");
+    luaL_dostring(l_, "b = a n = Dispatcher.drain() c = a");
+
+    lua_getglobal(l_, "b");
+    lua_getglobal(l_, "n");
+    lua_getglobal(l_, "c");
+    ASSERT_EQ(0, read<int>(l_, 1));
+    ASSERT_EQ(1, read<int>(l_, 2));
+    ASSERT_EQ(7, read<int>(l_, 3));
+
+    //The callback given in a coroutine runs after the coroutine is collected
+    luaL_dostring(l_, "co = coroutine.create(function() Module.post_from_thread(nil, function(this, v) d = v end) end)"
+                      " coroutine.resume(co) co = nil collectgarbage() Dispatcher.drain()");
+    lua_getglobal(l_, "d");
+    ASSERT_EQ(7, read<int>(l_, -1));
+}
+
+TEST_F(RegisterTest, async_functions)
+{
+    //Test functions that yield the coroutine until their result is ready
+    luaL_dostring(l_, "Module = require(\"Module\") Async = require(\"Async\")");
+    luaL_dostring(l_, "a = 0 b = '' "
+                      "Async.spawn(function() a = Module.delayed_double(nil, 21) end) "
+                      "Async.spawn(function() b = Module.reply_later(nil, 'ping') end) "
+                      "c = a Async.run()");
+    //Outside of a coroutine the call blocks
+    luaL_dostring(l_, "d = Module.delayed_double(nil, 2)");
+    luaL_dostring(l_, "Async.spawn(function() e, f = Module.failed_double(nil, 1) end) Async.run()");
+
+    lua_getglobal(l_, "c");
+    lua_getglobal(l_, "a");
+    lua_getglobal(l_, "b");
+    lua_getglobal(l_, "d");
+    ASSERT_EQ(0, read<int>(l_, 1));
+    ASSERT_EQ(42, read<int>(l_, 2));
+    ASSERT_EQ("reply to ping", read<std::string>(l_, 3));
+    ASSERT_EQ(4, read<int>(l_, 4));
+    lua_getglobal(l_, "e");
+    lua_getglobal(l_, "f");
+    ASSERT_TRUE(lua_isnil(l_, 5));
+    ASSERT_EQ("unknown exception", read<std::string>(l_, 6));
+}
+
+#ifdef CPPLUA_ENABLE_STATS
+TEST_F(RegisterTest, call_stats)
+{
+    //Test the counters of the bound functions and attributes
+    luaL_dostring(l_, "Module = require(\"Module\") Stats = require(\"Stats\")");
+    luaL_dostring(l_, "c = Module.Class(\"Dummy\", 1) for i = 1, 10 do c:get_name() end");
+    luaL_dostring(l_, "r = Module.make_right(nil, 3) r.right = r.right + 1");
+    luaL_dostring(l_, "s = Stats.get() a = s[\"Class.get_name\"].calls b = s[\"Right.right:set\"].calls");
+
+    lua_getglobal(l_, "a");
+    lua_getglobal(l_, "b");
+    ASSERT_EQ(10, read<int>(l_, 1));
+    ASSERT_EQ(1, read<int>(l_, 2));
+    const CallStats* stats = findCallStats(l_, "Class.get_name");
+    ASSERT_TRUE(stats != NULL);
+    ASSERT_EQ(10u, stats->calls.load());
+    ASSERT_EQ(1u, findCallStats(l_, "Right.right:get")->calls.load());
+
+    //An overload set is counted once per call under its name
+    luaL_dostring(l_, "o = Module.Overloaded() o:set(1) o:set(\"one\") Module.Overloaded.make()");
+    ASSERT_EQ(2u, findCallStats(l_, "Overloaded.set")->calls.load());
+    ASSERT_EQ(1u, findCallStats(l_, "make")->calls.load());
+}
+#endif
+
+#ifdef CPPLUA_ENABLE_INSTANCE_STATS
+TEST_F(RegisterTest, instance_stats)
+{
+    //Test the counters of the live instances of a class
+    luaL_dostring(l_, "Module = require(\"Module\") Instances = require(\"Instances\")");
+    const InstanceStats* stats = findInstanceStats("Class");
+    ASSERT_TRUE(stats != NULL);
+    const uint64_t live = stats->live.load();
+    const uint64_t bytes = stats->bytes.load();
+
+    luaL_dostring(l_, "objects = {} for i = 1, 3 do objects[i] = Module.Class(\"Dummy\", i) end");
+    ASSERT_EQ(live + 3, stats->live.load());
+    ASSERT_LE(bytes + 3 * sizeof(Class), stats->bytes.load());
+    ASSERT_LE(live + 3, stats->peak.load());
+
+    luaL_dostring(l_, "a = Instances.get(\"Class\").live d = Instances.dump()"
+                      " sorted = true for i = 2, #d do sorted = sorted and d[i - 1].bytes >= d[i].bytes end");
+    lua_getglobal(l_, "a");
+    lua_getglobal(l_, "sorted");
+    ASSERT_EQ(live + 3, read<uint64_t>(l_, 1));
+    ASSERT_TRUE(lua_toboolean(l_, 2));
+
+    //__gc called from Lua then by the collector counts the instance once
+    luaL_dostring(l_, "local o = objects[1] getmetatable(o).__gc(o) getmetatable(o).__gc(o)"
+                      " ok = pcall(o.get_name, o)");
+    ASSERT_EQ(live + 2, stats->live.load());
+    lua_getglobal(l_, "ok");
+    ASSERT_FALSE(lua_toboolean(l_, -1));
+
+    luaL_dostring(l_, "objects = nil collectgarbage()");
+    ASSERT_EQ(live, stats->live.load());
+    ASSERT_EQ(bytes, stats->bytes.load());
+}
+#endif
+
+TEST_F(RegisterTest, profiler)
+{
+    //Test the folded stacks of a profiler started at runtime, after the module is loaded
+    luaL_dostring(l_, "Module = require(\"Module\") Profiler = require(\"Profiler\")");
+    luaL_dostring(l_, "Profiler.start(10, true) c = Module.Class(\"Dummy\", 1)"
+                      " function f() for i = 1, 100 do c:get_name() Module.test_CFunction(nil) end end f() Profiler.stop()");
+    Profiler& profiler = Profiler::get(l_);
+    ASSERT_FALSE(profiler.running());
+
+    bool bound = false;
+    bool module = false;
+    bool lua = false;
+    for(auto it = profiler.samples().begin(); it != profiler.samples().end(); ++it)
+    {
+        //The bound method is called from f, called from the main chunk
+        if(it->first.find("f@") != std::string::npos && it->first.find(";Class.get_name") != std::string::npos)
+            bound = true;
+        if(it->first.find(";Module.test_CFunction") != std::string::npos)
+            module = true;
+        if(it->first.compare(0, 5, "main@") == 0)
+            lua = true;
+    }
+    ASSERT_TRUE(bound);
+    ASSERT_TRUE(module);
+    ASSERT_TRUE(lua);
+
+    luaL_dostring(l_, "written = Profiler.write(\"/tmp/cpplua_profile.folded\")");
+    lua_getglobal(l_, "written");
+    ASSERT_TRUE(lua_toboolean(l_, -1));
+    remove("/tmp/cpplua_profile.folded");
+    profiler.clear(l_);
+    ASSERT_TRUE(profiler.samples().empty());
+}
+
 TEST_F(RegisterTest, CFunction_return_nonvoid)
 {
 	//C function that returns something
@@ -609,6 +1331,144 @@ TEST(RegisterT, destructor)
     ASSERT_TRUE(destructor_called);
 }
 
+TEST(RegisterT, pool_allocator)
+{
+    //Test a state that uses the pool allocator
+    PoolAllocator allocator;
+    l_ = allocator.newstate();
+    openlib(l_);
+    luaL_getsubtable(l_, LUA_REGISTRYINDEX, "_PRELOAD");
+    registerModule<load_allocator>(l_, "Allocator");
+    lua_pop(l_, 1);
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "t = {} for i = 1, 1000 do t[i] = Module.Class(\"Dummy\" .. i, i) end");
+    luaL_dostring(l_, "s = require(\"Allocator\").stats() a = s.live b = s.peak");
+
+    lua_getglobal(l_, "a");
+    lua_getglobal(l_, "b");
+    ASSERT_LT(0u, read<unsigned int>(l_, 1));
+    ASSERT_LE(read<unsigned int>(l_, 1), read<unsigned int>(l_, 2));
+    ASSERT_GE(allocator.stats().peak_bytes, read<unsigned int>(l_, 2));
+    ASSERT_GE(allocator.stats().allocations, 1000u);
+    lua_close(l_);
+    ASSERT_EQ(0u, allocator.stats().live_bytes);
+    ASSERT_EQ(allocator.stats().allocations, allocator.stats().frees);
+
+    //A large block resized by realloc is neither allocated nor freed again
+    const std::size_t allocations = allocator.stats().allocations;
+    void* block = PoolAllocator::alloc(&allocator, NULL, 0, 1000);
+    block = PoolAllocator::alloc(&allocator, block, 1000, 4000);
+    block = PoolAllocator::alloc(&allocator, block, 4000, 2000);
+    ASSERT_EQ(allocations + 1, allocator.stats().allocations);
+    ASSERT_EQ(2000u, allocator.stats().live_bytes);
+    PoolAllocator::alloc(&allocator, block, 2000, 0);
+    ASSERT_EQ(allocator.stats().allocations, allocator.stats().frees);
+    ASSERT_EQ(0u, allocator.stats().live_bytes);
+}
+
+TEST(RegisterT, bytecode_cache)
+{
+    //Test a module compiled once then loaded from the cache by require
+    const char* source = "return { answer = function() return 42 end }";
+    FILE* f = fopen("/tmp/cached_module.lua", "w");
+    fputs(source, f);
+    fclose(f);
+    char cached[64];
+    snprintf(cached, sizeof(cached), "/tmp/%016llx.luac",
+             static_cast<unsigned long long>(BytecodeCache::key(source, strlen(source), "@/tmp/cached_module.lua")));
+    remove(cached);
+    BytecodeCache cache("/tmp");
+    int answers[2];
+    for(int i = 0; i < 2; ++i)
+    {
+        l_ = luaL_newstate();
+        openlib(l_);
+        cache.install(l_);
+        luaL_dostring(l_, "package.path = '/tmp/?.lua' a = require(\"cached_module\").answer()");
+        //The modules of _PRELOAD are still found first
+        luaL_dostring(l_, "Module2 = require(\"Module2\")");
+        lua_getglobal(l_, "a");
+        lua_getglobal(l_, "Module2");
+        answers[i] = read<int>(l_, 1);
+        ASSERT_TRUE(lua_istable(l_, 2));
+        lua_close(l_);
+    }
+    ASSERT_EQ(42, answers[0]);
+    ASSERT_EQ(42, answers[1]);
+    ASSERT_EQ(1u, cache.misses());
+    ASSERT_EQ(1u, cache.hits());
+    remove("/tmp/cached_module.lua");
+    remove(cached);
+}
+
+TEST(RegisterT, state_pool)
+{
+    //Test jobs run on several states built from the same registrations
+    StateRegistry registry;
+    registry.module<load_module_two>("Module2")
+            .script("Module2 = require(\"Module2\") "
+                    "function square(x) return x * x end "
+                    "function has_base() return Module2.BaseModule ~= nil end");
+    StatePool pool(registry, 3);
+
+    std::vector<std::future<int> > results;
+    for(int i = 1; i <= 100; ++i)
+        results.push_back(pool.submit<int>("square", i));
+    std::future<bool> base = pool.submit<bool>("has_base");
+    std::future<int> failure = pool.submit<int>("missing");
+
+    int total = 0;
+    for(std::size_t i = 0; i < results.size(); ++i)
+        total += results[i].get();
+    ASSERT_EQ(338350, total);
+    ASSERT_TRUE(base.get());
+    ASSERT_THROW(failure.get(), std::runtime_error);
+
+    std::size_t jobs = 0;
+    for(std::size_t i = 0; i < pool.size(); ++i)
+        jobs += pool.stats(i).jobs;
+    ASSERT_EQ(102u, jobs);
+}
+
+TEST(RegisterT, state_pool_inheritance)
+{
+    //Test states registering inherited classes while the others run jobs
+    StateRegistry registry;
+    registry.module<load_pool_classes>("Pool")
+            .script("Pool = require(\"Pool\") "
+                    "function right_of_both() return Pool.Both():get_right() end "
+                    "function is_derive() return Pool.Derive() ~= nil end "
+                    "function bad_error() error({}) end");
+    StatePool first(registry, 2);
+    std::vector<std::future<int> > results;
+    for(int i = 0; i < 50; ++i)
+        results.push_back(first.submit<int>("right_of_both"));
+    StatePool second(registry, 2);
+    for(int i = 0; i < 50; ++i)
+        results.push_back(second.submit<int>("right_of_both"));
+
+    int total = 0;
+    for(std::size_t i = 0; i < results.size(); ++i)
+        total += results[i].get();
+    ASSERT_EQ(200, total);
+    ASSERT_TRUE(second.submit<bool>("is_derive").get());
+
+    //The errors that are not strings and the results of the wrong type
+    std::future<int> bad_error = first.submit<int>("bad_error");
+    std::future<Right> bad_result = first.submit<Right>("right_of_both");
+    ASSERT_THROW(bad_error.get(), std::runtime_error);
+    ASSERT_THROW(bad_result.get(), std::runtime_error);
+    //An argument of a class the pool states do not know
+    std::future<bool> bad_argument = first.submit<bool>("is_derive", ns1::Twin());
+    ASSERT_THROW(bad_argument.get(), std::runtime_error);
+    ASSERT_EQ(2, first.submit<int>("right_of_both").get());
+
+    //A step that fails fails the construction of the pool
+    StateRegistry failing;
+    failing.script("error(\"broken script\")");
+    ASSERT_THROW(StatePool(failing, 2), std::runtime_error);
+}
+
 TEST_F(RegisterTest, table_parameter)
 {
 	//Function that takes a Table parameter
@@ -653,6 +1513,39 @@ TEST_F(RegisterTest, func_return_table)
 
 }
 
+TEST_F(RegisterTest, table_path)
+{
+    //Test the paths split once to read and write nested tables
+    luaL_dostring(l_, "config = { server = { port = 8080, host = \"localhost\" } }");
+    Table config("config", l_);
+    const TablePath port(l_, "server.port");
+    TablePath host(l_, "server");
+    host = TablePath(l_, "server.host");
+    ASSERT_EQ(8080, config.get<int>(port));
+    ASSERT_EQ(std::string("localhost"), config.get<std::string>(host));
+    ASSERT_EQ(2, port.get_size());
+
+    //The missing nested tables are added
+    const TablePath name(l_, "server.name.first");
+    config.set(name, std::string("main"));
+    config.set(TablePath(port), 9090);
+    ASSERT_EQ(std::string("main"), config.get<std::string>(name));
+    luaL_dostring(l_, "first = config.server.name.first port = config.server.port");
+    lua_getglobal(l_, "first");
+    lua_getglobal(l_, "port");
+    ASSERT_EQ(std::string("main"), read<std::string>(l_, 1));
+    ASSERT_EQ(9090, read<int>(l_, 2));
+
+    //A path of the main thread used by a table of a coroutine
+    lua_State* thread = lua_newthread(l_);
+    Table in_thread("config", thread);
+    ASSERT_EQ(9090, in_thread.get<int>(port));
+    in_thread.set(port, 8000);
+    ASSERT_EQ(8000, config.get<int>(port));
+    ASSERT_EQ(3, lua_gettop(l_));
+    ASSERT_EQ(0, lua_gettop(thread));
+}
+
 TEST_F(RegisterTest, inheritance)
 {
 	//Test the inheritance with two classes in the same module
@@ -665,6 +1558,28 @@ TEST_F(RegisterTest, inheritance)
     ASSERT_EQ(7, derive_count);
 }
 
+TEST_F(RegisterTest, lazy_classes)
+{
+    //Test classes whose metatables are created on first use
+    parent_count = 0;
+    derive_count = 0;
+    luaL_dostring(l_, "Lazy = require(\"Lazy\") r = debug.getregistry()");
+    luaL_dostring(l_, "a = r.Base == nil and r.Derive == nil");
+    //Building the child builds its parent
+    luaL_dostring(l_, "derive = Lazy.Derive() derive:countDerive() derive:countBase()");
+    luaL_dostring(l_, "b = r.Base ~= nil and r.StaticClass == nil");
+    luaL_dostring(l_, "c = Lazy.StaticClass.static_sum(3, 5)");
+
+    lua_getglobal(l_, "a");
+    lua_getglobal(l_, "b");
+    lua_getglobal(l_, "c");
+    ASSERT_TRUE(read<bool>(l_, 1));
+    ASSERT_TRUE(read<bool>(l_, 2));
+    ASSERT_EQ(8, read<int>(l_, 3));
+    ASSERT_EQ(10, parent_count);
+    ASSERT_EQ(7, derive_count);
+}
+
 TEST_F(RegisterTest, inheritance_through_module)
 {
 	//Test the inheritance with two classes in two differents modules
@@ -677,6 +1592,82 @@ TEST_F(RegisterTest, inheritance_through_module)
     ASSERT_EQ(7, derive_count);
 }
 
+TEST_F(RegisterTest, inheritance_deep)
+{
+    //Test the inheritance with three levels, the methods are flattened
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "deep = Module.DeriveDeep()");
+    luaL_dostring(l_, "deep:countDeep()");
+    luaL_dostring(l_, "deep:countDerive()");
+    luaL_dostring(l_, "deep:countBase()");
+    luaL_dostring(l_, "same = (deep.countBase == Module.Base().countBase)");
+
+    lua_getglobal(l_, "same");
+    ASSERT_TRUE(read<bool>(l_, 1));
+    ASSERT_EQ(10, parent_count);
+    ASSERT_EQ(7, derive_count);
+    ASSERT_EQ(3, deep_count);
+}
+
+TEST_F(RegisterTest, multiple_inheritance)
+{
+    //Test that the pointer is adjusted for the second base
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "both = Module.Both()");
+    luaL_dostring(l_, "l = both:get_left()");
+    luaL_dostring(l_, "r = both:get_right()");
+    luaL_dostring(l_, "r2 = Module.read_right(nil, both)");
+    luaL_dostring(l_, "both.right = 3 r3 = both.right");
+    //The parent is not at the address of the class
+    luaL_dostring(l_, "tagged = Module.Tagged() tagged.right = 5");
+    luaL_dostring(l_, "r4 = tagged:get_right() + tagged:tag()");
+
+    lua_getglobal(l_, "l");
+    lua_getglobal(l_, "r");
+    lua_getglobal(l_, "r2");
+    lua_getglobal(l_, "r3");
+    lua_getglobal(l_, "r4");
+    ASSERT_EQ(1, read<int>(l_, 1));
+    ASSERT_EQ(2, read<int>(l_, 2));
+    ASSERT_EQ(2, read<int>(l_, 3));
+    ASSERT_EQ(3, read<int>(l_, 4));
+    ASSERT_EQ(9, read<int>(l_, 5));
+}
+
+TEST_F(RegisterTest, ownership)
+{
+    //Test the objects returned by value, borrowed and held by smart pointers
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "a = Module.make_right(nil, 4):get_right()");
+    luaL_dostring(l_, "b = Module.borrow_right(nil) b.right = 5");
+    luaL_dostring(l_, "s = Module.share_right(nil) c = Module.count_shared(nil, s)");
+    luaL_dostring(l_, "u = Module.own_right(nil, 6) d = u.right e = Module.take_right(nil, u)");
+
+    lua_getglobal(l_, "a");
+    lua_getglobal(l_, "c");
+    lua_getglobal(l_, "d");
+    lua_getglobal(l_, "e");
+    ASSERT_EQ(4, read<int>(l_, 1));
+    ASSERT_EQ(5, borrowed_right.right);
+    //The global, the userdata and the parameter
+    ASSERT_EQ(3, read<int>(l_, 2));
+    ASSERT_EQ(6, read<int>(l_, 3));
+    ASSERT_EQ(6, read<int>(l_, 4));
+}
+
+TEST_F(RegisterTest, same_class_name)
+{
+    //Two classes with the same name in two namespaces keep their own metatable
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "one = Module.TwinOne():value()");
+    luaL_dostring(l_, "two = Module.TwinTwo():value()");
+
+    lua_getglobal(l_, "one");
+    lua_getglobal(l_, "two");
+    ASSERT_EQ(1, read<int>(l_, 1));
+    ASSERT_EQ(2, read<int>(l_, 2));
+}
+
 TEST_F(RegisterTest, callFunctionWithLua)
 {
 	//Test a simple member function from lua.
@@ -701,6 +1692,54 @@ TEST_F(RegisterTest, register_optional)
     ASSERT_EQ(1, register_optional_int);
 }
 
+TEST_F(RegisterTest, overloads)
+{
+    //Test the overload set dispatched on the number and type of the arguments
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "o = Module.Overloaded()");
+    luaL_dostring(l_, "class = Module.Class(\"Dummy\", 10)");
+    luaL_dostring(l_, "a = o:set(5)");
+    luaL_dostring(l_, "b = o:set(\"five\")");
+    luaL_dostring(l_, "c = o:set(2, 3)");
+    luaL_dostring(l_, "d = o:set(class)");
+    luaL_dostring(l_, "e = Module.Overloaded.make(1)");
+    luaL_dostring(l_, "f = Module.Overloaded.make()");
+    //No overload takes three arguments or none
+    luaL_dostring(l_, "g = pcall(o.set, o, 1, 2, 3) or pcall(o.set, o)");
+
+    lua_getglobal(l_, "a");
+    lua_getglobal(l_, "b");
+    lua_getglobal(l_, "c");
+    lua_getglobal(l_, "d");
+    lua_getglobal(l_, "e");
+    lua_getglobal(l_, "f");
+    lua_getglobal(l_, "g");
+    ASSERT_EQ(1, read<int>(l_, 1));
+    ASSERT_EQ(2, read<int>(l_, 2));
+    ASSERT_EQ(3, read<int>(l_, 3));
+    ASSERT_EQ(4, read<int>(l_, 4));
+    ASSERT_EQ(1, read<int>(l_, 5));
+    ASSERT_EQ(2, read<int>(l_, 6));
+    ASSERT_FALSE(read<bool>(l_, 7));
+}
+
+TEST_F(RegisterTest, functors)
+{
+    //Test the lambdas with captures and the runtime member function pointers
+    luaL_dostring(l_, "Module = require(\"Module\")");
+    luaL_dostring(l_, "class = Module.Class(\"Dummy\", 10)");
+    luaL_dostring(l_, "a = Module.add_offset(2)");
+    luaL_dostring(l_, "b = Module.greet(nil, \"World\")");
+    luaL_dostring(l_, "c = class:get_index_runtime()");
+
+    lua_getglobal(l_, "a");
+    lua_getglobal(l_, "b");
+    lua_getglobal(l_, "c");
+    ASSERT_EQ(7, read<int>(l_, 1));
+    ASSERT_EQ(std::string("Hello World"), read<std::string>(l_, 2));
+    ASSERT_EQ(10, read<int>(l_, 3));
+}
+
 TEST_F(RegisterTest, attribute)
 {
 	//Test the public attribute